@@ -20,7 +20,7 @@
 #include <stdlib.h>
 
 int stop;
-int v;
+int v,op;
 sharcs_id feature;
 
 static const char *types[] = {
@@ -110,6 +110,17 @@ int main(int argc,char **argv) {
 				return 0;
 			}
 			v = atoi(argv[2]);
+			
+			/* relative: +n/-n, next, prev or toggle */
+			op = -1;
+			if(argv[2][0] == '+' || argv[2][0] == '-') {
+				op = SHARCS_OP_ADD;
+			} else if(!strcmp(argv[2],"next") || !strcmp(argv[2],"prev")) {
+				op = SHARCS_OP_NEXT;
+				v = argv[2][0] == 'n' ? 1 : -1;
+			} else if(!strcmp(argv[2],"toggle")) {
+				op = SHARCS_OP_TOGGLE;
+			}
 		}
 	} else {
 		return 0;
@@ -128,7 +139,11 @@ int main(int argc,char **argv) {
 			sharcs_profile_load(v);
 			break;
 		case 2:
-			sharcs_set_i(feature,v);
+			if(op >= 0) {
+				sharcs_set_op(feature,op,v,0);
+			} else {
+				sharcs_set_i(feature,v);
+			}
 			break;
 	}
 	
@@ -57,6 +57,7 @@ void handlePacket(struct sharcs_packet *p);
 void readFromSocket();
 void writeToSocket();
 void sendPacket(struct sharcs_packet *p);
+void queueData(const char *buffer, int len);
 void wakeUp();
 void* run(void *threadid);
 void updateFeatureI(sharcs_id id,int v);
@@ -89,7 +90,7 @@ void readFromSocket() {
 
 		/* check that the packet was completly received */
 		if(packetLen > readCounter) {
-			if(packetLen > 1024) {
+			if(packetLen > SHARCS_MAX_PACKET) {
 				/* @TODO close connection */
 			}
             break;
@@ -138,16 +139,7 @@ void writeToSocket() {
 	pthread_mutex_unlock(&mutex_write);
 }	
 
-void sendPacket(struct sharcs_packet *p) {
-	pthread_mutex_unlock(&mutex_write);
-	
-	int len = packet_size(p);
-
-	packet_seek(p,0);
-	packet_append32(p,len);
-
-	const char *buffer = packet_buffer(p);
-
+void queueData(const char *buffer, int len) {
     if(writeBufferSize <= writeCounter + len) {
         while(writeBufferSize <= writeCounter + len) {
             writeBufferSize*=2;
@@ -157,6 +149,42 @@ void sendPacket(struct sharcs_packet *p) {
 
 	memcpy(writeBuffer + writeCounter, buffer, len);
 	writeCounter += len;
+}
+
+void sendPacket(struct sharcs_packet *p) {
+	struct sharcs_packet *chunk;
+	const char *buffer;
+	int len,n,i;
+	
+	pthread_mutex_lock(&mutex_write);
+	
+	len = packet_size(p);
+
+	packet_seek(p,0);
+	packet_append32(p,len);
+
+	buffer = packet_buffer(p);
+	
+	/* split messages exceeding the frame limit into chunks */
+	if(len > SHARCS_MAX_PACKET) {
+		for(i=0;i<len;i+=n) {
+			n = len-i;
+			if(n > SHARCS_MAX_PACKET-(4+1+4)) {
+				n = SHARCS_MAX_PACKET-(4+1+4);
+			}
+			
+			chunk = packet_create();
+			packet_append32(chunk,4+1+4+n);
+			packet_append8(chunk,M_C_CHUNK);
+			packet_append32(chunk,len);
+			packet_append_data(chunk,buffer+i,n);
+			
+			queueData(packet_buffer(chunk),packet_size(chunk));
+			packet_delete(chunk);
+		}
+	} else {
+		queueData(buffer,len);
+	}
 		
 	pthread_mutex_unlock(&mutex_write);
 }
@@ -299,6 +327,17 @@ void handlePacket(struct sharcs_packet *p) {
 			updateFeatureI(f,v);
 			break;
 		}
+		case M_S_FEATURE_DESIRED: {
+			int f,v;
+			
+			f = packet_read32(p);
+			v = packet_read32(p);
+			
+			if(sharcs_callback) {
+				sharcs_callback(LIBSHARCS_EVENT_DESIRED,f,v);
+			}
+			break;
+		}
 		case M_S_FEATURE_S: {
 			int f;
 			const char *s;
@@ -443,6 +482,77 @@ void handlePacket(struct sharcs_packet *p) {
 			
 			break;
 		}
+		case M_S_PROFILE_LIST: {
+			unsigned int total,offset,n,i,j;
+			int flags;
+			struct sharcs_profile *profile;
+			
+			total 	= packet_read32(p);
+			offset 	= packet_read32(p);
+			n 		= packet_read32(p);
+			flags 	= packet_read8(p);
+			
+			/* pages have to be requested in order */
+			if(offset > profiles_size) {
+				break;
+			}
+			
+			/* first page => delete current list */
+			if(offset == 0 && profiles) {
+				for(i=0;i<profiles_size;i++) {
+					free((void*)profiles[i]->profile_name);
+					free(profiles[i]->profile_features);
+					free(profiles[i]->profile_values);
+					free(profiles[i]);
+				}
+				free(profiles);
+				profiles = NULL;
+				profiles_size = 0;
+			}
+			
+			j = total>offset+n?total:offset+n;
+			if(profiles_size>j) {
+				j = profiles_size;
+			}
+			profiles = (struct sharcs_profile**)realloc(profiles,sizeof(struct sharcs_profile*)*j);
+			
+			for(i=0;i<n;i++) {
+				profile = (struct sharcs_profile*)malloc(sizeof(struct sharcs_profile));
+				profile->profile_id 			= packet_read32(p);
+				profile->profile_name 			= strdup(packet_read_string(p));
+				profile->profile_size			= 0;
+				profile->profile_features 		= NULL;
+				profile->profile_values 		= NULL;
+				
+				if(!(flags & SHARCS_PROFILE_LIST_SUMMARY)) {
+					profile->profile_size		= packet_read32(p);
+					profile->profile_features 	= (int*)malloc(sizeof(int)*profile->profile_size);
+					profile->profile_values 	= (int*)malloc(sizeof(int)*profile->profile_size);
+					
+					for(j=0;j<profile->profile_size;j++) {
+						profile->profile_features[j] 	= packet_read32(p);
+						profile->profile_values[j] 		= packet_read32(p);
+					}
+				}
+				
+				/* replace profile received earlier */
+				if(offset+i < profiles_size) {
+					free((void*)profiles[offset+i]->profile_name);
+					free(profiles[offset+i]->profile_features);
+					free(profiles[offset+i]->profile_values);
+					free(profiles[offset+i]);
+				} else {
+					profiles_size++;
+				}
+				profiles[offset+i] = profile;
+			}
+			
+			if(sharcs_callback) {
+				sharcs_callback(LIBSHARCS_EVENT_PROFILE_LIST,offset,n);
+			}
+			
+			break;
+		}
 		case M_S_PROFILE_LOAD: {
 			int id,state;
 
@@ -642,6 +752,30 @@ int sharcs_set_i(sharcs_id feature,int value) {
     return 1;
 }
 
+int sharcs_set_op(sharcs_id feature,int op,int argument,int expected) {
+	struct sharcs_packet *p;
+
+    if(clientSocket<0) {
+        return 0;
+    }
+	
+	p = packet_create();
+	packet_append32(p,0);
+	packet_append8(p,M_C_FEATURE_OP);
+	packet_append32(p,feature);
+	packet_append8(p,op);
+	packet_append32(p,argument);
+	packet_append32(p,expected);
+	
+	sendPacket(p);
+	
+	wakeUp();
+	
+	packet_delete(p);
+
+    return 1;
+}
+
 int sharcs_set_s(sharcs_id feature,const char* value) {
 	struct sharcs_packet *p;
 	
@@ -745,6 +879,34 @@ int sharcs_profile_delete(int profile_id) {
 	return 1;
 }
 
+/* stores the current values of the given modules, devices or features as profile */
+int sharcs_profile_capture(int profile_id,const char *name,const sharcs_id *ids,int n) {
+	struct sharcs_packet *p;
+	int i;
+    
+    if(clientSocket<0) {
+        return 0;
+    }
+	
+	p = packet_create();
+    packet_append32(p,0);
+    packet_append8(p,M_C_PROFILE_CAPTURE);
+	packet_append32(p,profile_id);
+	packet_append_string(p,name ? name : "");
+	packet_append32(p,n);
+	for(i=0;i<n;i++) {
+		packet_append32(p,ids[i]);
+	}
+	
+	sendPacket(p);
+	
+	wakeUp();
+	
+	packet_delete(p);
+    
+	return 1;
+}
+
 /* enumeration */
 int sharcs_profiles() {
 	struct sharcs_packet *p;
@@ -766,6 +928,29 @@ int sharcs_profiles() {
     return 1;
 }
 
+int sharcs_profile_list(unsigned int offset,unsigned int limit,int flags) {
+	struct sharcs_packet *p;
+    
+    if(clientSocket<0) {
+        return 0;
+    }
+	
+    p = packet_create();
+    packet_append32(p,0);
+    packet_append8(p,M_C_PROFILE_LIST);
+	packet_append32(p,offset);
+	packet_append32(p,limit);
+	packet_append8(p,flags);
+    
+	sendPacket(p);
+	
+	wakeUp();
+	
+	packet_delete(p);
+    
+    return 1;
+}
+
 int sharcs_retrieve() {
 	struct sharcs_packet *p;
     
@@ -22,6 +22,9 @@ enum {
 	LIBSHARCS_EVENT_PROFILE_DELETE,
 	LIBSHARCS_EVENT_PROFILE_SAVE,
 	LIBSHARCS_EVENT_PROFILE_LOAD,
+	LIBSHARCS_EVENT_PROFILE_LIST,
+	/* feature (id) is being set to value, SHARCS_VALUE_UNKNOWN once settled */
+	LIBSHARCS_EVENT_DESIRED,
 };
 
 int sharcs_init(const char* server,int (*)(sharcs_id,int),int (*)(sharcs_id,const char*),void (*)(int,int,int));
@@ -30,6 +33,7 @@ int sharcs_stop();
 /* enumeration */
 int sharcs_retrieve();
 int sharcs_profiles();
+int sharcs_profile_list(unsigned int offset,unsigned int limit,int flags);
 
 int sharcs_enumerate_modules(struct sharcs_module **module,int index);
 int sharcs_enumerate_profiles(struct sharcs_profile **profile,int index);
@@ -42,8 +46,11 @@ struct sharcs_profile* sharcs_profile(int id);
 /* features */
 int sharcs_set_i(sharcs_id,int);
 int sharcs_set_s(sharcs_id,const char*);
+/* SHARCS_OP_*, expected is only used by SHARCS_OP_CAS */
+int sharcs_set_op(sharcs_id,int op,int argument,int expected);
 
 /* profiles */
 int sharcs_profile_save(struct sharcs_profile *profile);
 int sharcs_profile_load(int profile_id);
-int sharcs_profile_delete(int profile_id);
\ No newline at end of file
+int sharcs_profile_delete(int profile_id);
+int sharcs_profile_capture(int profile_id,const char *name,const sharcs_id *ids,int n);
\ No newline at end of file
@@ -168,6 +168,12 @@ void packet_append_string(struct sharcs_packet *packet,const char *cstr) {
 	ADVANCE(len+1);
 }
 
+void packet_append_data(struct sharcs_packet *packet,const char *data,int len) {
+	CHECKSIZE(len);
+	memcpy(packet->data+packet->cursor, data, len);
+	ADVANCE(len);
+}
+
 uint8_t packet_read8(struct sharcs_packet *packet) {
 	uint8_t val = packet->data[packet->cursor];
 	ADVANCE(sizeof(uint8_t));
@@ -74,6 +74,7 @@ void packet_append32(struct sharcs_packet *packet,uint32_t dword);
 void packet_append64(struct sharcs_packet *packet,uint64_t qword);
 void packet_append_string(struct sharcs_packet *packet,const char *string);
 void packet_append_float(struct sharcs_packet *packet,float f);
+void packet_append_data(struct sharcs_packet *packet,const char *data,int len);
          
 uint8_t packet_read8(struct sharcs_packet *packet);
 uint16_t packet_read16(struct sharcs_packet *packet);
@@ -42,8 +42,9 @@ struct sharcs_connection {
 	int connected;
 	int socket;
 	int flags;
-	char *writeBuffer,*readBuffer;
+	char *writeBuffer,*readBuffer,*chunkBuffer;
 	int readCounter, writeCounter, writeBufferSize, readBufferSize;
+	int chunkCounter, chunkSize;
 	time_t lastPing,lastPong;
 };
 
@@ -54,6 +55,11 @@ int stopEvent;
 struct sharcs_connection connections[10];
 pthread_mutex_t mutex_connections;
 
+/* features whose desired value changed, guarded by mutex_desired which nests in no other lock */
+sharcs_id *desiredFeatures;
+int desiredSize;
+pthread_mutex_t mutex_desired = PTHREAD_MUTEX_INITIALIZER;
+
 void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p);
 
 void closeConnection(struct sharcs_connection *con) {
@@ -65,8 +71,13 @@ void closeConnection(struct sharcs_connection *con) {
 	
 	free(con->writeBuffer);
 	free(con->readBuffer);
+	free(con->chunkBuffer);
 	
-	con->connected = 0;
+	/* the buffers are gone, nothing may be parsed or sent any more */
+	con->readCounter 	= 0;
+	con->writeCounter 	= 0;
+	con->chunkBuffer 	= NULL;
+	con->connected 		= 0;
 	
 	fprintf(stdout,"[NET] client #%u disconnected\n",con->id);
 }
@@ -98,7 +109,7 @@ void readFromSocket(struct sharcs_connection *con) {
 
 		/* check that the packet was completly received */
 		if(packetLen > con->readCounter) {
-			if(packetLen > 1024) {
+			if(packetLen > SHARCS_MAX_PACKET) {
 				fprintf(stdout,"[NET] received invalid packet - packet length exceeds maximum size\n");
 				closeConnection(con);
 			}
@@ -119,6 +130,11 @@ void readFromSocket(struct sharcs_connection *con) {
             handlePacket(con, p);
 
 			packet_delete(p);
+			
+			/* the packet may have closed the connection */
+			if(!con->connected) {
+				break;
+			}
         }
 	}
 }
@@ -185,6 +201,187 @@ void wakeUp() {
 	write(pipeFD[1], ".", 1);
 }
 
+/*
+ * a set issued by a client completed, the new value reaches all clients
+ * with the report of the module. failures are only sent to the client
+ * which issued the set.
+ */
+void featureComplete(sharcs_id feature,int result,void *userdata) {
+	struct sharcs_connection *connection;
+	struct sharcs_packet *p;
+	int i;
+	
+	if(result == SHARCS_COMPLETE_OK || result == SHARCS_COMPLETE_SUPERSEDED) {
+		return;
+	}
+	
+	p = packet_create();
+	packet_append32(p,0);
+	packet_append8(p,M_S_FEATURE_ERROR);
+	packet_append32(p,feature);
+	
+	pthread_mutex_lock(&mutex_connections);
+	for(i=0;i<10;i++) {
+		connection = &connections[i];
+		if(connection->connected && connection->id == (unsigned int)(long)userdata) {
+			sendPacket(connection,p);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex_connections);
+	
+	wakeUp();
+	
+	packet_delete(p);
+}
+
+void appendProfile(struct sharcs_packet *p, struct sharcs_profile *profile, int summary) {
+	int j;
+	
+	packet_append32(p,profile->profile_id);
+	packet_append_string(p,profile->profile_name);
+	
+	if(summary) {
+		return;
+	}
+
+	packet_append32(p,profile->profile_size);
+	for(j=0;j<profile->profile_size;j++) {
+		packet_append32(p,profile->profile_features[j]);
+		packet_append32(p,profile->profile_values[j]);
+	}
+}
+
+/*
+ * messages larger than SHARCS_MAX_PACKET are sent as a sequence of M_C_CHUNK
+ * frames, each carrying the total message size followed by the next part of
+ * the message. the message is handled once all parts were received.
+ */
+void handleChunk(struct sharcs_connection *con, struct sharcs_packet *p) {
+	struct sharcs_packet *p2;
+	int size,len;
+	
+	if(p->size < 4+1+4) {
+		return;
+	}
+	
+	size 	= packet_read32(p);
+	len 	= p->size - p->cursor;
+	
+	/* first chunk of a message */
+	if(!con->chunkBuffer) {
+		if(size < 4+1 || size > SHARCS_MAX_MESSAGE) {
+			fprintf(stdout,"[NET] received invalid chunk - message size %d exceeds limit\n",size);
+			closeConnection(con);
+			return;
+		}
+		con->chunkBuffer 	= (char*)malloc(size);
+		con->chunkSize 		= size;
+		con->chunkCounter 	= 0;
+	}
+	
+	if(size != con->chunkSize || con->chunkCounter + len > con->chunkSize) {
+		fprintf(stdout,"[NET] received invalid chunk - message size mismatch\n");
+		closeConnection(con);
+		return;
+	}
+	
+	memcpy(con->chunkBuffer + con->chunkCounter, p->data + p->cursor, len);
+	con->chunkCounter += len;
+	
+	if(con->chunkCounter < con->chunkSize) {
+		return;
+	}
+	
+	/* message complete */
+	p2 = packet_create_buffer(con->chunkBuffer,con->chunkSize);
+	
+	free(con->chunkBuffer);
+	con->chunkBuffer = NULL;
+	
+	if(bswap_32(*(uint32_t*)p2->data) != p2->size || p2->data[4] == M_C_CHUNK) {
+		fprintf(stdout,"[NET] received invalid chunked message\n");
+	} else {
+		handlePacket(con,p2);
+	}
+	
+	packet_delete(p2);
+}
+
+/* notifies clients about a saved profile, or the requesting client about the failure */
+void sendProfileSaved(struct sharcs_connection *con, struct sharcs_profile *profile) {
+	struct sharcs_packet *p;
+	
+	p = packet_create();
+	packet_append32(p,0);
+	packet_append8(p,M_S_PROFILE_SAVE);
+	
+	if(!profile) {
+		packet_append32(p,0);
+		sendPacket(con,p);
+	} else {
+		appendProfile(p,profile,0);
+		distributePacket(p,SHARCS_CF_PROFILES);
+	}
+	
+	packet_delete(p);
+}
+
+/* sends the desired values which changed to all clients, mutex_connections is not held */
+void distributeDesired() {
+	struct sharcs_packet *p;
+	sharcs_id *features;
+	int i,n;
+	
+	pthread_mutex_lock(&mutex_desired);
+	features 		= desiredFeatures;
+	n 				= desiredSize;
+	desiredFeatures = NULL;
+	desiredSize 	= 0;
+	pthread_mutex_unlock(&mutex_desired);
+	
+	for(i=0;i<n;i++) {
+		p = packet_create();
+		packet_append32(p,0);
+		packet_append8(p,M_S_FEATURE_DESIRED);
+		packet_append32(p,features[i]);
+		packet_append32(p,sharcs_feature_desired(features[i]));
+		distributePacket(p,0);
+		packet_delete(p);
+	}
+	
+	free(features);
+}
+
+/* desired values still to be reached, following the reported ones */
+void sendDesired(struct sharcs_connection *con) {
+	struct sharcs_module *m;
+	struct sharcs_device *d;
+	struct sharcs_packet *p;
+	int i,j,k,v;
+	
+	i = 0;
+	while(sharcs_enumerate_modules(&m,i++)) {
+		for(j=0;j<m->module_devices_size;j++) {
+			d = m->module_devices[j];
+			for(k=0;k<d->device_features_size;k++) {
+				v = sharcs_feature_desired(d->device_features[k]->feature_id);
+				if(v == SHARCS_VALUE_UNKNOWN) {
+					continue;
+				}
+				
+				p = packet_create();
+				packet_append32(p,0);
+				packet_append8(p,M_S_FEATURE_DESIRED);
+				packet_append32(p,d->device_features[k]->feature_id);
+				packet_append32(p,v);
+				sendPacket(con,p);
+				packet_delete(p);
+			}
+		}
+	}
+}
+
 void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 	int packetLen, packetType;
 	struct sharcs_packet *p2;
@@ -198,6 +395,10 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 	packetType 	= packet_read8(p);
 
 	switch(packetType) {
+		case M_C_CHUNK: {
+			handleChunk(con,p);
+			break;
+		}
 		/* ping => reply with pong */
 		case M_C_PONG: {
 			con->lastPong = time(NULL);
@@ -214,7 +415,7 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			f = packet_read32(p);
 			v = packet_read32(p);
 			
-			if(sharcs_set_i(f,v)!=1) {
+			if(sharcs_set_i(f,v,&featureComplete,(void*)(long)con->id)!=1) {
 				/* @TODO include reason for failure, and add request id's */
 				p2 = packet_create();
 				packet_append32(p2,0);
@@ -226,6 +427,31 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			
 			break;
 		}
+		case M_C_FEATURE_OP: {
+			int f,op,arg,expected;
+			
+			/* check packet size */
+			if(p->size < 4+1+4+1+4+4) {
+				return;
+			}
+			
+			f 			= packet_read32(p);
+			op 			= packet_read8(p);
+			arg 		= packet_read32(p);
+			expected 	= packet_read32(p);
+			
+			/* a value which does not change is no error */
+			if(!sharcs_feature_op(f,op,arg,expected,&featureComplete,(void*)(long)con->id)) {
+				p2 = packet_create();
+				packet_append32(p2,0);
+				packet_append8(p2,M_S_FEATURE_ERROR);
+				packet_append32(p2,f);
+				sendPacket(con,p2);
+				packet_delete(p2);
+			}
+			
+			break;
+		}
 		case M_C_FEATURE_S: {
 			int f;
 			const char *s;
@@ -294,6 +520,8 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			/* send packet */
 			sendPacket(con,p2);
 			packet_delete(p2);
+			
+			sendDesired(con);
 			break;
 		}
 		case M_C_RETRIEVE: {
@@ -371,6 +599,7 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			sendPacket(con,p2);
 			packet_delete(p2);
 			
+			sendDesired(con);
 			break;
 		}
 		case M_C_PROFILE_LOAD: {
@@ -398,7 +627,7 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 		}
 		case M_C_PROFILES: {
 			struct sharcs_profile *profile;
-			int i,j;
+			int i;
 			
 			if(!(con->flags & SHARCS_CF_PROFILES)) {
 				con->flags |= SHARCS_CF_PROFILES;
@@ -412,14 +641,7 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			
 			i = 0;
 			while(sharcs_enumerate_profiles(&profile,i++)) {
-				packet_append32(p2,profile->profile_id);
-				packet_append_string(p2,profile->profile_name);
-
-				packet_append32(p2,profile->profile_size);
-				for(j=0;j<profile->profile_size;j++) {
-					packet_append32(p2,profile->profile_features[j]);
-					packet_append32(p2,profile->profile_values[j]);
-				}
+				appendProfile(p2,profile,0);
 			}
 
 			/* update number of profiles */
@@ -432,6 +654,61 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			
 			break;
 		}
+		case M_C_PROFILE_LIST: {
+			struct sharcs_profile *profile;
+			unsigned int offset,limit,total,n;
+			int flags,stream;
+			
+			if(p->size < 4+1+4+4+1) {
+				return;
+			}
+			
+			offset 	= packet_read32(p);
+			limit 	= packet_read32(p);
+			flags 	= packet_read8(p);
+			
+			if(!(con->flags & SHARCS_CF_PROFILES)) {
+				con->flags |= SHARCS_CF_PROFILES;
+			}
+			
+			/* no limit => stream all remaining profiles page by page */
+			stream = !limit;
+			if(stream || limit > SHARCS_PROFILE_LIST_PAGE) {
+				limit = SHARCS_PROFILE_LIST_PAGE;
+			}
+			
+			total = 0;
+			while(sharcs_enumerate_profiles(&profile,total)) {
+				total++;
+			}
+			
+			do {
+				p2 = packet_create();
+				packet_append32(p2,0);
+				packet_append8(p2,M_S_PROFILE_LIST);
+				packet_append32(p2,total);
+				packet_append32(p2,offset);
+				packet_append32(p2,0);
+				packet_append8(p2,flags);
+				
+				n = 0;
+				while(n<limit && sharcs_enumerate_profiles(&profile,offset+n)) {
+					appendProfile(p2,profile,flags & SHARCS_PROFILE_LIST_SUMMARY);
+					n++;
+				}
+				
+				/* update number of profiles in this page */
+				packet_seek(p2,4+1+4+4);
+				packet_append32(p2,n);
+				
+				sendPacket(con,p2);
+				packet_delete(p2);
+				
+				offset += n;
+			} while(stream && n>0 && offset<total);
+			
+			break;
+		}
 		case M_C_PROFILE_SAVE: {
 			struct sharcs_profile *profile;
 			int ret,j;
@@ -450,38 +727,50 @@ void handlePacket(struct sharcs_connection *con, struct sharcs_packet *p) {
 			
 			ret = sharcs_profile_save(profile);
 			
-			p2 = packet_create();
-			packet_append32(p2,0);
-			packet_append8(p2,M_S_PROFILE_SAVE);
-			
 			/* action failed */
 			if(!ret) {
 				free((void*)profile->profile_name);
 				free(profile->profile_features);
 				free(profile->profile_values);
 				free(profile);
-
-				packet_append32(p2,0);
-				sendPacket(con,p2);
-			/* success */
-			} else {
-				packet_append32(p2,profile->profile_id);
-			
-				packet_append_string(p2,profile->profile_name);
-
-				packet_append32(p2,profile->profile_size);
-				for(j=0;j<profile->profile_size;j++) {
-					packet_append32(p2,profile->profile_features[j]);
-					packet_append32(p2,profile->profile_values[j]);
-				}
-			
-				distributePacket(p2,SHARCS_CF_PROFILES);
+				profile = NULL;
 			}
 			
-			packet_delete(p2);
+			sendProfileSaved(con,profile);
 						
 			break;			
 		}
+		case M_C_PROFILE_CAPTURE: {
+			struct sharcs_profile *profile;
+			const char *name;
+			sharcs_id *ids;
+			int id,n,j;
+			
+			if(p->size < 4+1+4+4+1+4) {
+				return;
+			}
+			
+			id 		= packet_read32(p);
+			name 	= packet_read_string(p);
+			n 		= packet_read32(p);
+			
+			if(n < 0 || p->cursor + n*4 > p->size) {
+				return;
+			}
+			
+			ids = (sharcs_id*)malloc(sizeof(sharcs_id)*n);
+			for(j=0;j<n;j++) {
+				ids[j] = packet_read32(p);
+			}
+			
+			profile = sharcs_profile_capture(id,name,ids,n);
+			
+			free(ids);
+			
+			sendProfileSaved(con,profile);
+			
+			break;
+		}
 		case M_C_PROFILE_DELETE: {
 			int ret,j,id;
 			
@@ -522,6 +811,11 @@ int sharcs_connection_stop() {
 	return 0;
 }
 
+int sharcs_connection_wakeup() {
+	wakeUp();
+	return 1;
+}
+
 int sharcs_connection_start() {
 	fd_set ReadFDs, WriteFDs, ExceptFDs;
 
@@ -586,6 +880,14 @@ int sharcs_connection_start() {
 		maxSocket = serverSocket;
 		tv.tv_sec 	= 30;
 		tv.tv_usec 	= 0;
+		
+		/* run timers */
+		if((i = sharcs_tick()) >= 0 && i < 30000) {
+			tv.tv_sec 	= i/1000;
+			tv.tv_usec 	= (i%1000)*1000;
+		}
+		
+		distributeDesired();
 
 		FD_ZERO(&ReadFDs);
 		FD_ZERO(&WriteFDs);
@@ -675,6 +977,7 @@ int sharcs_connection_start() {
 
 					    connection->readBuffer     = (char*)malloc(connection->readBufferSize);
 					    connection->writeBuffer    = (char*)malloc(connection->writeBufferSize);
+					    connection->chunkBuffer    = NULL;
 						
 						connection->connected = 1;
 						connection->id = connectionId++;
@@ -814,4 +1117,29 @@ int sharcs_connection_feature(sharcs_id feature) {
 	wakeUp();
 	
 	packet_delete(p);
+}
+
+/*
+ * the desired value of the feature changed. it is sent by the network
+ * thread, which reads the current value before taking mutex_connections,
+ * the last packet sent for a feature carries the latest value.
+ */
+int sharcs_connection_desired(sharcs_id feature) {
+	int i;
+	
+	pthread_mutex_lock(&mutex_desired);
+	for(i=0;i<desiredSize;i++) {
+		if(desiredFeatures[i] == feature) {
+			break;
+		}
+	}
+	if(i>=desiredSize) {
+		desiredFeatures = (sharcs_id*)realloc(desiredFeatures,sizeof(sharcs_id)*(desiredSize+1));
+		desiredFeatures[desiredSize++] = feature;
+	}
+	pthread_mutex_unlock(&mutex_desired);
+	
+	wakeUp();
+	
+	return 1;
 }
\ No newline at end of file
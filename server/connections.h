@@ -19,7 +19,9 @@
 
 int sharcs_connection_start();
 int sharcs_connection_stop();
+int sharcs_connection_wakeup();
 int sharcs_connection_feature(sharcs_id feature);
+int sharcs_connection_desired(sharcs_id feature);
 
 int sharcs_connection_profile(int profile_id, int state);
 
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <pthread.h>
+
+#include "../sharcs.h"
+#include "main.h"
+#include "groups.h"
+
+#define GROUPS_MAX 64
+
+/*
+ * a set of a group is desired for all members at once, the dispatchers of
+ * their modules pass them in parallel. switch groups are on while any
+ * member is on, range groups show the average of their members. members
+ * have the type of the group, range groups take the bounds of the first.
+ */
+struct group {
+	struct sharcs_feature feature;
+	
+	int members_size;
+	sharcs_id *members;
+	
+	// last value reported by each member, sum and number of the known ones
+	int *values;
+	int sum,known;
+	
+	/* value last reported for the group */
+	int reported;
+};
+
+/* a set of a group, completes once every member completed */
+struct group_set {
+	sharcs_token token;
+	int remaining;
+	int result;
+};
+
+struct group groups[GROUPS_MAX];
+int groups_size;
+pthread_mutex_t mutex_groups;
+
+struct sharcs_feature *groups_features[GROUPS_MAX];
+struct sharcs_device groups_device,*groups_devices[1];
+sharcs_id groups_module_id;
+
+void (*groups_callback)(const struct sharcs_value*,int);
+void (*groups_complete)(sharcs_token,int);
+
+/*-----------------------------------*/
+
+/* members which did not report yet are left out, unknown until one did */
+int group_value(struct group *g) {
+	if(!g->known) {
+		return SHARCS_VALUE_UNKNOWN;
+	}
+	
+	if(g->feature.feature_type == SHARCS_FEATURE_SWITCH) {
+		return g->sum > 0;
+	}
+	
+	return g->sum/g->known;
+}
+
+void group_value_add(struct group *g,int value,int sign) {
+	if(value == SHARCS_VALUE_UNKNOWN) {
+		return;
+	}
+	
+	g->sum 		+= sign*value;
+	g->known 	+= sign;
+}
+
+struct group* group_find(sharcs_id feature) {
+	int i;
+	
+	for(i=0;i<groups_size;i++) {
+		if(groups[i].feature.feature_id == feature) {
+			return &groups[i];
+		}
+	}
+	
+	return NULL;
+}
+
+/* adds the member if it fits the group, the first one decides the type */
+int group_member_add(struct group *g,sharcs_id id) {
+	struct sharcs_feature *f;
+	int value;
+	
+	f = sharcs_feature(id);
+	if(!f || SHARCS_ID_MODULE(id) == groups_module_id) {
+		return 0;
+	}
+	
+	switch(f->feature_type) {
+		case SHARCS_FEATURE_SWITCH:
+			value = SHARCS_V_SWITCH(f);
+			break;
+		case SHARCS_FEATURE_RANGE:
+			value = SHARCS_V_RANGE(f);
+			break;
+		default:
+			return 0;
+	}
+	
+	if(!g->members_size) {
+		g->feature.feature_type 	= f->feature_type;
+		g->feature.feature_flags 	= f->feature_flags & (SHARCS_FLAG_SLIDER | SHARCS_FLAG_INVERSE);
+		g->feature.feature_value 	= f->feature_value;
+	} else if(f->feature_type != g->feature.feature_type) {
+		return 0;
+	}
+	
+	g->members 	= (sharcs_id*)realloc(g->members,sizeof(sharcs_id)*(g->members_size+1));
+	g->values 	= (int*)realloc(g->values,sizeof(int)*(g->members_size+1));
+	
+	g->members[g->members_size] = id;
+	g->values[g->members_size] 	= value;
+	g->members_size++;
+	
+	group_value_add(g,value,1);
+	
+	return 1;
+}
+
+/* parses "name: id id ...", returns 0 if the line holds no group */
+int group_parse(struct group *g,char *line) {
+	char *name,*p,*end;
+	unsigned long id;
+	
+	while(isspace(*line)) {
+		line++;
+	}
+	if(*line == '#' || !(p = strchr(line,':'))) {
+		return 0;
+	}
+	
+	*p++ = 0x0;
+	name = line;
+	
+	memset(g,0,sizeof(struct group));
+	
+	for(;;) {
+		id = strtoul(p,&end,0);
+		if(end == p) {
+			break;
+		}
+		p = end;
+		
+		if(!group_member_add(g,(sharcs_id)id)) {
+			fprintf(stderr,"[Groups] ignoring feature %lx in group '%s'\n",id,name);
+		}
+	}
+	
+	if(!g->members_size) {
+		return 0;
+	}
+	
+	g->feature.feature_name 		= strdup(name);
+	g->feature.feature_description 	= "group";
+	g->reported 					= group_value(g);
+	
+	if(g->feature.feature_type == SHARCS_FEATURE_SWITCH) {
+		g->feature.feature_value.v_switch.state = g->reported;
+	} else {
+		g->feature.feature_value.v_range.value 	= g->reported;
+	}
+	
+	return 1;
+}
+
+/*-----------------------------------
+ * sets
+ *-----------------------------------
+ */
+void group_member_done(sharcs_id feature,int result,void *userdata) {
+	struct group_set *set;
+	int done;
+	
+	set = (struct group_set*)userdata;
+	
+	pthread_mutex_lock(&mutex_groups);
+	
+	/* any failure fails the group, otherwise superseded members supersede it */
+	if(result == SHARCS_COMPLETE_FAILED || result == SHARCS_COMPLETE_TIMEOUT) {
+		set->result = SHARCS_COMPLETE_FAILED;
+	} else if(result == SHARCS_COMPLETE_SUPERSEDED && set->result == SHARCS_COMPLETE_OK) {
+		set->result = SHARCS_COMPLETE_SUPERSEDED;
+	}
+	done = !--set->remaining;
+	
+	pthread_mutex_unlock(&mutex_groups);
+	
+	if(done) {
+		groups_complete(set->token,set->result);
+		free(set);
+	}
+}
+
+int group_set_batch(const sharcs_id *features, const int *values, const sharcs_token *tokens, int n) {
+	struct sharcs_module *m;
+	struct group_set *set;
+	struct sharcs_feature *f;
+	struct group *g;
+	sharcs_id *ids;
+	int *member_values,*issued;
+	int i,j,k,l;
+	
+	for(i=0;i<n;i++) {
+		if(!(g = group_find(features[i]))) {
+			break;
+		}
+		
+		fprintf(stdout,"[Groups] setting %d features of '%s' to '%d'\n",g->members_size,g->feature.feature_name,values[i]);
+		
+		set = (struct group_set*)malloc(sizeof(struct group_set));
+		set->token 		= tokens[i];
+		set->remaining 	= g->members_size;
+		set->result 	= SHARCS_COMPLETE_OK;
+		
+		ids 			= (sharcs_id*)malloc(sizeof(sharcs_id)*g->members_size);
+		member_values 	= (int*)malloc(sizeof(int)*g->members_size);
+		issued 			= (int*)calloc(g->members_size,sizeof(int));
+		
+		/* one batch per module */
+		for(j=0;j<g->members_size;j++) {
+			if(issued[j]) {
+				continue;
+			}
+			m = sharcs_module(g->members[j]);
+			
+			for(k=0,l=j;l<g->members_size;l++) {
+				if(issued[l] || sharcs_module(g->members[l]) != m) {
+					continue;
+				}
+				issued[l] = 1;
+				
+				ids[k] 				= g->members[l];
+				member_values[k] 	= values[i];
+				
+				/* members may have narrower bounds */
+				if((f = sharcs_feature(ids[k])) && f->feature_type == SHARCS_FEATURE_RANGE) {
+					if(member_values[k] < f->feature_value.v_range.start) {
+						member_values[k] = f->feature_value.v_range.start;
+					} else if(member_values[k] > f->feature_value.v_range.end) {
+						member_values[k] = f->feature_value.v_range.end;
+					}
+				}
+				k++;
+			}
+			
+			sharcs_desire(m,ids,member_values,k,&group_member_done,set);
+		}
+		
+		free(ids);
+		free(member_values);
+		free(issued);
+	}
+	
+	return i;
+}
+
+/*-----------------------------------
+ * module interface
+ *-----------------------------------
+ */
+int group_start() {
+	return 1;
+}
+
+int group_stop() {
+	return 1;
+}
+
+int group_set_i(sharcs_id feature, int value) {
+	sharcs_token token = 0;
+	
+	return group_set_batch(&feature,&value,&token,1);
+}
+
+int group_set_s(sharcs_id feature, const char *value) {
+	return 0;
+}
+
+void groups_member(sharcs_id feature,int value) {
+	struct sharcs_value reports[GROUPS_MAX];
+	struct group *g;
+	int i,j,n,member;
+	
+	if(SHARCS_ID_MODULE(feature) == groups_module_id) {
+		return;
+	}
+	
+	pthread_mutex_lock(&mutex_groups);
+	
+	for(n=0,i=0;i<groups_size;i++) {
+		g = &groups[i];
+		
+		for(member=0,j=0;j<g->members_size;j++) {
+			if(g->members[j] == feature) {
+				group_value_add(g,g->values[j],-1);
+				group_value_add(g,value,1);
+				
+				g->values[j] 	= value;
+				member 			= 1;
+			}
+		}
+		
+		if(member && group_value(g) != g->reported) {
+			g->reported 		= group_value(g);
+			reports[n].id 		= g->feature.feature_id;
+			reports[n].value 	= g->reported;
+			n++;
+		}
+	}
+	
+	pthread_mutex_unlock(&mutex_groups);
+	
+	if(n) {
+		groups_callback(reports,n);
+	}
+}
+
+int groups_init(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int)) {
+	char line[1024];
+	FILE *f;
+	
+	groups_module_id 	= mod->module_id;
+	groups_callback 	= cb;
+	groups_complete 	= complete;
+	
+	f = fopen(GROUPS_FILE,"r");
+	if(!f) {
+		return 0;
+	}
+	
+	groups_device.device_id = SHARCS_ID_DEVICE_MAKE(mod->module_id,1);
+	
+	while(groups_size < GROUPS_MAX && fgets(line,sizeof(line),f)) {
+		line[strcspn(line,"\r\n")] = 0x0;
+		
+		if(!group_parse(&groups[groups_size],line)) {
+			continue;
+		}
+		
+		groups[groups_size].feature.feature_id 	= SHARCS_ID_FEATURE_MAKE(mod->module_id,groups_device.device_id,groups_size+1);
+		groups_features[groups_size] 			= &groups[groups_size].feature;
+		groups_size++;
+	}
+	
+	fclose(f);
+	
+	if(!groups_size) {
+		return 0;
+	}
+	
+	pthread_mutex_init(&mutex_groups,NULL);
+	
+	groups_device.device_name 			= "Groups";
+	groups_device.device_description 	= "features of several devices";
+	groups_device.device_flags 			= 0;
+	groups_device.device_features_size 	= groups_size;
+	groups_device.device_features 		= groups_features;
+	groups_devices[0] 					= &groups_device;
+	
+	/* fill module structure */
+	mod->module_name 			= "Groups";
+	mod->module_description 	= "set features of several devices at once";
+	mod->module_version 		= "1.0";
+	mod->module_devices_size 	= 1;
+	mod->module_devices 		= groups_devices;
+	mod->module_start 			= &group_start;
+	mod->module_stop 			= &group_stop;
+	mod->module_set_i			= &group_set_i;
+	mod->module_set_s 			= &group_set_s;
+	mod->module_set_batch		= &group_set_batch;
+	
+	return 1;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _GROUPS_H_
+#define _GROUPS_H_
+
+/*
+ * built-in module of virtual features, each setting the features of
+ * several devices at once. groups are read from GROUPS_FILE, one per
+ * line: "name: feature-id feature-id ...". returns 0 without groups.
+ */
+#define GROUPS_FILE "/etc/sharcsd/groups"
+
+int groups_init(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int));
+
+/* a feature reported a value, groups containing it are updated */
+void groups_member(sharcs_id feature,int value);
+
+#endif
@@ -24,29 +24,183 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/param.h>
+#include <sys/time.h>
 
 #include <pthread.h>
 
 #include "../sharcs.h"
 #include "../packet.h"
+#include "main.h"
+#include "connections.h"
+#include "groups.h"
 
 #define EACTIVE -1
 
+/* profile file header, older files start with an 8 bit profile count */
+#define PROFILES_MAGIC 0x53485032
+
 /* modules */
 int modules_size = 0;
 struct sharcs_module modules[10];
 void* modules_lib_handle[10];
+/* SHARCS_MODULE_ABI the module was built for, decides which fields it provides */
+int modules_abi[10];
 
 /* profiles */
 struct sharcs_profile **profiles,*profile_pending;
-int profiles_size,profile_queue;
+int profiles_size;
 pthread_mutex_t mutex_profile;
 
+/* compiled profiles, one plan per entry in profiles */
+struct profile_step {
+	struct sharcs_module *module;
+	struct sharcs_device *device;
+	struct sharcs_feature *feature;
+	int value;
+};
+
+struct profile_plan {
+	int schema;
+	int failed;
+	int steps_size;
+	struct profile_step *steps;
+	int devices_size;
+	int *devices;
+};
+
+struct profile_plan **profile_plans,*profile_plan_pending;
+
+/* state of the pending profile, the steps of each device form a lane */
+#define PROFILE_RETRIES 3
+
+struct profile_lane {
+	int next,end;
+	int waiting;
+	int retries;
+};
+
+struct profile_lane *profile_lanes;
+int profile_advancing,profile_readvance;
+/* incremented for every load, completions of earlier loads are ignored */
+long profile_serial;
+
+/* 
+ * sets awaiting completion by their module, guarded by mutex_profile.
+ * the core resolves them as timed out after COMPLETION_TIMEOUT, which
+ * has to cover the longest delay a module may queue a command for.
+ */
+#define COMPLETION_TIMEOUT 60000
+
+struct completion {
+	sharcs_token token;
+	sharcs_id feature;
+	int value;
+	/* module without tokens, completed by the next report of the feature */
+	int inferred;
+	long long deadline;
+	void (*done)(sharcs_id feature,int result,void *userdata);
+	void *userdata;
+};
+
+struct completion *completions;
+int completions_size;
+sharcs_token completion_last;
+
+/*
+ * desired values, guarded by mutex_profile. a feature has at most one set
+ * passed to its module, values set meanwhile replace each other and only
+ * the last one is passed once the module completed. entries are removed
+ * by the dispatcher when nothing is sent or waiting anymore.
+ */
+struct desire {
+	sharcs_id feature;
+	struct sharcs_module *module;
+	int value;
+	
+	// set passed to the module
+	int sending,sent;
+	void (*sent_done)(sharcs_id,int,void*);
+	void *sent_userdata;
+	
+	// latest value, waiting for the module
+	int queued;
+	void (*done)(sharcs_id,int,void*);
+	void *userdata;
+};
+
+struct desire *desires;
+int desires_size;
+
+/*
+ * every module has a thread passing the desired values to it, a blocking
+ * module only holds up its own devices. devices of a module take turns,
+ * module_rate and module_inflight of the module apply. completions reach
+ * connections from these threads, so modules and notices are only called
+ * with mutex_profile released.
+ */
+struct dispatcher {
+	struct sharcs_module *module;
+	pthread_t thread;
+	
+	// rate limit, thousandths of a set
+	long long credit,credit_time;
+	
+	/* device served first in the next round */
+	int next;
+};
+
+struct dispatcher dispatchers[10];
+int dispatchers_stop;
+
+/* signalled whenever values are desired or sets complete */
+pthread_cond_t desire_cond = PTHREAD_COND_INITIALIZER;
+
+/* callbacks collected under mutex_profile, run after unlocking */
+struct desire_notice {
+	sharcs_id feature;
+	/* NULL to tell clients the desired value changed */
+	void (*done)(sharcs_id,int,void*);
+	void *userdata;
+	int result;
+};
+
+/*
+ * profile steps run with mutex_profile held, their notices and profile
+ * states are collected here and emitted by profile_flush() once it is
+ * released. mutex_connections is never taken while holding mutex_profile.
+ */
+struct profile_report {
+	int profile_id;
+	int state;
+};
+
+struct desire_notice *profile_notices;
+int profile_notices_size;
+struct profile_report *profile_reports;
+int profile_reports_size;
+
+/* devices which were powered on and do not accept commands yet */
+struct device_warmup {
+	struct sharcs_device *device;
+	long long deadline;
+};
+
+struct device_warmup *warmups;
+int warmups_size;
+
+/* incremented whenever modules, devices or features change */
+int schema_generation;
+
 /* env variables */
 char *path_binary;
 
 void profile_advance();
+void profile_done(sharcs_id id,int result,void *userdata);
+void desire_notify(struct desire_notice *notices,int n);
+int desire_add(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata,struct desire_notice *notices);
 void profiles_load();
+int feature_valid(struct sharcs_feature *f,int value);
+int feature_value(struct sharcs_feature *f);
 
 /*-----------------------------------*/
 
@@ -60,7 +214,8 @@ void profiles_save() {
 	if(f) {
 		p = packet_create();
 		/* serialize all profiles */
-		packet_append8(p,0);
+		packet_append32(p,PROFILES_MAGIC);
+		packet_append32(p,0);
 		
 		i = 0;
 		while(sharcs_enumerate_profiles(&profile,i++)) {
@@ -75,8 +230,8 @@ void profiles_save() {
 		}
 
 		/* update number of profiles */
-		packet_seek(p,0);
-		packet_append8(p,i-1);
+		packet_seek(p,4);
+		packet_append32(p,i-1);
 
 		fwrite(p->data,p->size,1,f);
 		fclose(f);
@@ -116,9 +271,15 @@ void profiles_load() {
 		p = packet_create_buffer(buffer,length);
 		
 		/* load all profiles */
-		profiles_size = packet_read8(p);
+		if(length >= 8 && packet_read32(p) == PROFILES_MAGIC) {
+			profiles_size = packet_read32(p);
+		} else {
+			packet_seek(p,0);
+			profiles_size = packet_read8(p);
+		}
 			
 		profiles = (struct sharcs_profile**)malloc(sizeof(struct sharcs_profile*)*profiles_size);
+		profile_plans = (struct profile_plan**)malloc(sizeof(struct profile_plan*)*profiles_size);
 			
 		for(i=0;i<profiles_size;i++) {
 			profile = (struct sharcs_profile*)malloc(sizeof(struct sharcs_profile));
@@ -128,52 +289,897 @@ void profiles_load() {
 			profile->profile_features 		= (int*)malloc(sizeof(int)*profile->profile_size);
 			profile->profile_values 		= (int*)malloc(sizeof(int)*profile->profile_size);
 
-			for(j=0;j<profile->profile_size;j++) {
-				profile->profile_features[j] 	= packet_read32(p);
-				profile->profile_values[j] 		= packet_read32(p);
-			}
+			for(j=0;j<profile->profile_size;j++) {
+				profile->profile_features[j] 	= packet_read32(p);
+				profile->profile_values[j] 		= packet_read32(p);
+			}
+			
+			profiles[i] = profile;
+			profile_plans[i] = NULL;
+		}
+		
+		packet_delete(p);
+	}
+}
+
+/*
+ * resolves module and feature of every step once and validates the values,
+ * steps are grouped per device in order of first appearance, keeping the
+ * order of steps for the same device
+ */
+struct profile_plan* profile_compile(struct sharcs_profile *profile) {
+	struct profile_plan *plan;
+	struct profile_step *step;
+	sharcs_id device;
+	int i,j,k;
+	
+	plan = (struct profile_plan*)malloc(sizeof(struct profile_plan));
+	plan->schema 		= schema_generation;
+	plan->failed 		= -1;
+	plan->steps_size 	= 0;
+	plan->steps 		= (struct profile_step*)malloc(sizeof(struct profile_step)*profile->profile_size);
+	plan->devices_size 	= 0;
+	plan->devices 		= (int*)malloc(sizeof(int)*profile->profile_size);
+	
+	for(i=0;i<profile->profile_size;i++) {
+		device = SHARCS_ID_DEVICE(profile->profile_features[i]);
+		
+		/* device already grouped */
+		for(j=0;j<i;j++) {
+			if(SHARCS_ID_DEVICE(profile->profile_features[j]) == device) {
+				break;
+			}
+		}
+		if(j<i) {
+			continue;
+		}
+		
+		plan->devices[plan->devices_size++] = plan->steps_size;
+		
+		for(k=i;k<profile->profile_size;k++) {
+			if(SHARCS_ID_DEVICE(profile->profile_features[k]) != device) {
+				continue;
+			}
+			
+			step = &plan->steps[plan->steps_size++];
+			step->module 	= sharcs_module(profile->profile_features[k]);
+			step->device 	= sharcs_device(profile->profile_features[k]);
+			step->feature 	= sharcs_feature(profile->profile_features[k]);
+			step->value 	= profile->profile_values[k];
+			
+			if(plan->failed<0 && (!step->module || !step->feature || !feature_valid(step->feature,step->value))) {
+				plan->failed = k;
+			}
+		}
+	}
+	
+	return plan;
+}
+
+void profile_plan_delete(struct profile_plan *plan) {
+	if(!plan) {
+		return;
+	}
+	free(plan->steps);
+	free(plan->devices);
+	free(plan);
+}
+
+/* returns the plan of a profile, recompiling it if the schema changed */
+struct profile_plan* profile_plan(struct sharcs_profile *profile) {
+	int i;
+	
+	for(i=0;i<profiles_size;i++) {
+		if(profiles[i] == profile) {
+			break;
+		}
+	}
+	if(i>=profiles_size) {
+		return NULL;
+	}
+	
+	if(!profile_plans[i] || profile_plans[i]->schema != schema_generation) {
+		profile_plan_delete(profile_plans[i]);
+		profile_plans[i] = profile_compile(profile);
+	}
+	
+	return profile_plans[i];
+}
+
+void profiles_compile() {
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	for(i=0;i<profiles_size;i++) {
+		profile_plan(profiles[i]);
+	}
+	pthread_mutex_unlock(&mutex_profile);
+}
+
+
+/* the caller holds mutex_profile, the state is sent by profile_flush() */
+void profile_report(int profile_id,int state) {
+	profile_reports = (struct profile_report*)realloc(profile_reports,sizeof(struct profile_report)*(profile_reports_size+1));
+	profile_reports[profile_reports_size].profile_id 	= profile_id;
+	profile_reports[profile_reports_size].state 		= state;
+	profile_reports_size++;
+}
+
+/* emits what profile steps collected, the caller must not hold mutex_profile */
+void profile_flush() {
+	struct desire_notice *notices;
+	struct profile_report *reports;
+	int i,n,r;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	notices 	= profile_notices;
+	n 			= profile_notices_size;
+	reports 	= profile_reports;
+	r 			= profile_reports_size;
+	
+	profile_notices 		= NULL;
+	profile_notices_size 	= 0;
+	profile_reports 		= NULL;
+	profile_reports_size 	= 0;
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	for(i=0;i<r;i++) {
+		sharcs_connection_profile(reports[i].profile_id,reports[i].state);
+	}
+	desire_notify(notices,n);
+	
+	free(notices);
+	free(reports);
+}
+
+void profile_finish(int state) {
+	profile_report(profile_pending->profile_id,state);
+	
+	free(profile_lanes);
+	
+	profile_lanes 			= NULL;
+	profile_pending 		= NULL;
+	profile_plan_pending 	= NULL;
+}
+
+/* skips steps already set, returns the step a lane has to issue next or NULL */
+struct profile_step* profile_lane_next(struct profile_lane *lane) {
+	struct profile_step *step;
+	
+	while(!lane->waiting && lane->next < lane->end) {
+		step = &profile_plan_pending->steps[lane->next];
+		
+		/* lane is resumed once the device is ready */
+		if(step->device->device_flags & SHARCS_FLAG_WARMUP) {
+			return NULL;
+		}
+		
+		/* value already set */
+		if(feature_value(step->feature) == step->value) {
+			lane->next++;
+			lane->retries = 0;
+			continue;
+		}
+		
+		return step;
+	}
+	
+	return NULL;
+}
+
+/*
+ * issues the next step of every lane until each has to be confirmed,
+ * the steps for the same module are passed in a single batch
+ */
+void profile_issue() {
+	struct sharcs_module *m;
+	struct profile_step *step;
+	sharcs_id *ids;
+	int *values,*lanes,*batch;
+	int i,j,k,n,done;
+	
+	n 		= profile_plan_pending->devices_size;
+	ids 	= (sharcs_id*)malloc(sizeof(sharcs_id)*n);
+	values 	= (int*)malloc(sizeof(int)*n);
+	lanes 	= (int*)malloc(sizeof(int)*n*2);
+	batch 	= lanes+n;
+	
+	for(n=0,done=1,i=0;i<profile_plan_pending->devices_size;i++) {
+		if(profile_lane_next(&profile_lanes[i])) {
+			lanes[n++] = i;
+		}
+		if(profile_lanes[i].next < profile_lanes[i].end) {
+			done = 0;
+		}
+	}
+	
+	for(i=0;i<n;i++) {
+		if(lanes[i]<0) {
+			continue;
+		}
+		m = profile_plan_pending->steps[profile_lanes[lanes[i]].next].module;
+		
+		for(k=0,j=i;j<n;j++) {
+			if(lanes[j]<0 || (step = &profile_plan_pending->steps[profile_lanes[lanes[j]].next])->module != m) {
+				continue;
+			}
+			batch[k] 	= lanes[j];
+			ids[k] 		= step->feature->feature_id;
+			values[k] 	= step->value;
+			lanes[j] 	= -1;
+			k++;
+		}
+		
+		for(j=0;j<k;j++) {
+			profile_lanes[batch[j]].waiting = 1;
+		}
+		
+		/* rejected values fail through profile_done */
+		profile_notices = (struct desire_notice*)realloc(profile_notices,sizeof(struct desire_notice)*(profile_notices_size+k*2));
+		profile_notices_size += desire_add(m,ids,values,k,&profile_done,(void*)profile_serial,profile_notices+profile_notices_size);
+	}
+	
+	free(ids);
+	free(values);
+	free(lanes);
+	
+	if(done && profile_pending) {
+		fprintf(stdout,"[Profile] finished!\n");
+		profile_finish(SHARCS_PROFILE_LOADED);
+	}
+}
+
+/* confirmations received while issuing are picked up by another round */
+void profile_advance() {
+	if(profile_advancing) {
+		profile_readvance = 1;
+		return;
+	}
+	
+	profile_advancing = 1;
+	do {
+		profile_readvance = 0;
+		profile_issue();
+	} while(profile_readvance && profile_pending);
+	profile_advancing = 0;
+}
+
+/* a step of the pending profile was completed by its module */
+void profile_done(sharcs_id id,int result,void *userdata) {
+	struct profile_lane *lane;
+	struct profile_step *step;
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	if(!profile_pending || (long)userdata != profile_serial) {
+		pthread_mutex_unlock(&mutex_profile);
+		return;
+	}
+	
+	for(i=0;i<profile_plan_pending->devices_size;i++) {
+		lane = &profile_lanes[i];
+		if(!lane->waiting) {
+			continue;
+		}
+		
+		step = &profile_plan_pending->steps[lane->next];
+		if(step->feature->feature_id != id) {
+			continue;
+		}
+		
+		lane->waiting = 0;
+		
+		if(result == SHARCS_COMPLETE_OK) {
+			lane->next++;
+			lane->retries = 0;
+		/* commands ignored while warming up are issued again once the device is ready */
+		} else if(!(step->device->device_flags & SHARCS_FLAG_WARMUP) && ++lane->retries > PROFILE_RETRIES) {
+			fprintf(stdout,"[Profile] step %d/%d not confirmed!\n",lane->next+1,profile_plan_pending->steps_size);
+			profile_finish(SHARCS_PROFILE_FAILED);
+			break;
+		}
+		
+		profile_advance();
+		break;
+	}
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	profile_flush();
+}
+
+/*-----------------------------------
+ * device warm-up
+ *-----------------------------------
+ */
+long long sharcs_now() {
+	struct timeval tv;
+	
+	gettimeofday(&tv,NULL);
+	
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+/* devices of v1 modules lack device_warmup */
+int device_warmup_time(struct sharcs_device *d) {
+	struct sharcs_module *m;
+	
+	m = sharcs_module(d->device_id);
+	if(!m || modules_abi[m-modules] < 2) {
+		return 0;
+	}
+	
+	return d->device_warmup;
+}
+
+/* device was powered on, assume it is busy until ready or device_warmup passed */
+void device_warmup_start(struct sharcs_device *d) {
+	int i,warmup;
+	
+	if((warmup = device_warmup_time(d)) <= 0) {
+		return;
+	}
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	for(i=0;i<warmups_size;i++) {
+		if(warmups[i].device == d) {
+			break;
+		}
+	}
+	if(i>=warmups_size) {
+		warmups_size++;
+		warmups = (struct device_warmup*)realloc(warmups,sizeof(struct device_warmup)*warmups_size);
+	}
+	
+	warmups[i].device 	= d;
+	warmups[i].deadline = sharcs_now()+warmup;
+	
+	d->device_flags |= SHARCS_FLAG_WARMUP;
+	
+	fprintf(stdout,"[Device] '%s' warming up\n",d->device_name);
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	/* connection loop has to pick up the new deadline */
+	sharcs_connection_wakeup();
+}
+
+void device_ready(struct sharcs_device *d) {
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	for(i=0;i<warmups_size;i++) {
+		if(warmups[i].device == d) {
+			warmups[i] = warmups[--warmups_size];
+			break;
+		}
+	}
+	
+	if(d->device_flags & SHARCS_FLAG_WARMUP) {
+		d->device_flags &= ~SHARCS_FLAG_WARMUP;
+		
+		fprintf(stdout,"[Device] '%s' ready\n",d->device_name);
+		
+		/* resume lanes waiting for the device */
+		if(profile_pending) {
+			profile_advance();
+		}
+	}
+	
+	pthread_mutex_unlock(&mutex_profile);
+}
+
+/*-----------------------------------
+ * completions
+ *-----------------------------------
+ */
+sharcs_token completion_add(sharcs_id feature,int value,int inferred,void (*done)(sharcs_id,int,void*),void *userdata) {
+	struct completion *c;
+	sharcs_token token;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	completions_size++;
+	completions = (struct completion*)realloc(completions,sizeof(struct completion)*completions_size);
+	
+	/* 0 is never handed out */
+	if(!++completion_last) {
+		completion_last++;
+	}
+	
+	c = &completions[completions_size-1];
+	c->token 	= completion_last;
+	c->feature 	= feature;
+	c->value 	= value;
+	c->inferred = inferred;
+	c->deadline = sharcs_now()+COMPLETION_TIMEOUT;
+	c->done 	= done;
+	c->userdata = userdata;
+	
+	/* completions may be reallocated once unlocked */
+	token = c->token;
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	return token;
+}
+
+/* removes a completion, the caller holds mutex_profile */
+struct completion completion_take(int i) {
+	struct completion c;
+	
+	c = completions[i];
+	completions[i] = completions[--completions_size];
+	
+	return c;
+}
+
+/* a set was not accepted by its module, nobody is notified */
+void completion_drop(sharcs_token token) {
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	for(i=0;i<completions_size;i++) {
+		if(completions[i].token == token) {
+			completion_take(i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex_profile);
+}
+
+/* callback of ABI v2 modules */
+void sharcs_complete(sharcs_token token,int result) {
+	struct completion c;
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	for(i=0;i<completions_size;i++) {
+		if(completions[i].token == token) {
+			break;
+		}
+	}
+	if(i>=completions_size) {
+		pthread_mutex_unlock(&mutex_profile);
+		return;
+	}
+	c = completion_take(i);
+	pthread_mutex_unlock(&mutex_profile);
+	
+	if(c.done) {
+		c.done(c.feature,result,c.userdata);
+	}
+}
+
+/* completes sets of modules without tokens by a report of the feature */
+void completion_report(sharcs_id feature,int value) {
+	struct completion c;
+	int i;
+	
+	for(;;) {
+		pthread_mutex_lock(&mutex_profile);
+		for(i=0;i<completions_size;i++) {
+			if(completions[i].inferred && completions[i].feature == feature) {
+				break;
+			}
+		}
+		if(i>=completions_size) {
+			pthread_mutex_unlock(&mutex_profile);
+			return;
+		}
+		c = completion_take(i);
+		pthread_mutex_unlock(&mutex_profile);
+		
+		if(c.done) {
+			c.done(c.feature,c.value == value ? SHARCS_COMPLETE_OK : SHARCS_COMPLETE_FAILED,c.userdata);
+		}
+	}
+}
+
+/* resolves overdue completions, returns the next deadline or -1 */
+long long completion_expire(long long now) {
+	struct completion c;
+	long long next;
+	int i;
+	
+	for(;;) {
+		pthread_mutex_lock(&mutex_profile);
+		for(next=-1,i=0;i<completions_size;i++) {
+			if(completions[i].deadline <= now) {
+				break;
+			}
+			if(next < 0 || completions[i].deadline < next) {
+				next = completions[i].deadline;
+			}
+		}
+		if(i>=completions_size) {
+			pthread_mutex_unlock(&mutex_profile);
+			return next;
+		}
+		c = completion_take(i);
+		pthread_mutex_unlock(&mutex_profile);
+		
+		fprintf(stdout,"[Module] set of feature %x timed out\n",c.feature);
+		
+		if(c.done) {
+			c.done(c.feature,SHARCS_COMPLETE_TIMEOUT,c.userdata);
+		}
+	}
+}
+
+/*-----------------------------------
+ * desired values
+ *-----------------------------------
+ */
+int desire_find(sharcs_id feature) {
+	int i;
+	
+	for(i=0;i<desires_size;i++) {
+		if(desires[i].feature == feature) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+/* never called with mutex_profile held */
+void desire_notify(struct desire_notice *notices,int n) {
+	int i;
+	
+	for(i=0;i<n;i++) {
+		if(notices[i].done) {
+			notices[i].done(notices[i].feature,notices[i].result,notices[i].userdata);
+		} else {
+			sharcs_connection_desired(notices[i].feature);
+		}
+	}
+}
+
+/* the set passed for the feature completed, the latest value is passed next */
+void desire_done(sharcs_id feature,int result,void *userdata) {
+	struct desire_notice notice;
+	int i;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	if((i = desire_find(feature)) < 0 || !desires[i].sending) {
+		pthread_mutex_unlock(&mutex_profile);
+		return;
+	}
+	
+	desires[i].sending = 0;
+	
+	notice.feature 	= feature;
+	notice.done 	= desires[i].sent_done;
+	notice.userdata = desires[i].sent_userdata;
+	notice.result 	= result;
+	
+	pthread_cond_broadcast(&desire_cond);
+	pthread_mutex_unlock(&mutex_profile);
+	
+	if(notice.done) {
+		desire_notify(&notice,1);
+	}
+}
+
+/* next value waiting for the device, NULL if there is none */
+struct desire* desire_waiting(struct sharcs_device *device) {
+	int i;
+	
+	for(i=0;i<desires_size;i++) {
+		if(desires[i].queued && !desires[i].sending && SHARCS_ID_DEVICE(desires[i].feature) == device->device_id) {
+			return &desires[i];
+		}
+	}
+	
+	return NULL;
+}
+
+/*
+ * passes the values waiting for the module in one batch, one device after
+ * the other. called with mutex_profile held once, which is released while
+ * notices are emitted and the module is called. returns 0 if values were
+ * passed, the ms until the rate allows the next one or -1 if nothing can
+ * be passed for now.
+ */
+long long dispatcher_issue(struct dispatcher *dp) {
+	struct sharcs_module *m;
+	struct desire_notice *notices;
+	struct sharcs_feature *f;
+	struct desire *d;
+	sharcs_id *ids;
+	int *values,*pending;
+	int i,j,k,c,budget,sent,progress;
+	long long now,wait;
+	
+	m 		= dp->module;
+	notices = (struct desire_notice*)malloc(sizeof(struct desire_notice)*(desires_size*3+1));
+	ids 	= (sharcs_id*)malloc(sizeof(sharcs_id)*(desires_size+1));
+	values 	= (int*)malloc(sizeof(int)*(desires_size+1));
+	pending = (int*)calloc(m->module_devices_size+1,sizeof(int));
+	
+	/* values reported already need no set, entries without values are settled */
+	for(c=0,i=0;i<desires_size;) {
+		d = &desires[i];
+		if(d->module != m || d->sending) {
+			i++;
+			continue;
+		}
+		
+		if(d->queued) {
+			if(!(f = sharcs_feature(d->feature)) || feature_value(f) != d->value) {
+				i++;
+				continue;
+			}
+			
+			d->queued = 0;
+			
+			if(d->done) {
+				notices[c].feature 	= d->feature;
+				notices[c].done 	= d->done;
+				notices[c].userdata = d->userdata;
+				notices[c].result 	= SHARCS_COMPLETE_OK;
+				c++;
+			}
+		}
+		
+		/* clients fall back to the reported value */
+		notices[c].feature 	= d->feature;
+		notices[c].done 	= NULL;
+		c++;
+		
+		desires[i] = desires[--desires_size];
+	}
+	
+	/* sets pending per device */
+	for(i=0;i<desires_size;i++) {
+		if(desires[i].module != m || !desires[i].sending) {
+			continue;
+		}
+		for(j=0;j<m->module_devices_size;j++) {
+			if(SHARCS_ID_DEVICE(desires[i].feature) == m->module_devices[j]->device_id) {
+				pending[j]++;
+				break;
+			}
+		}
+	}
+	
+	now = sharcs_now();
+	if(m->module_rate > 0) {
+		dp->credit += (now-dp->credit_time)*m->module_rate;
+		if(dp->credit > 1000LL*m->module_rate) {
+			dp->credit = 1000LL*m->module_rate;
+		}
+		dp->credit_time = now;
+		budget = dp->credit/1000;
+	} else {
+		budget = desires_size;
+	}
+	
+	/* one value per device and round */
+	for(k=0,progress=1;progress && k<budget;) {
+		for(progress=0,i=0;i<m->module_devices_size && k<budget;i++) {
+			j = (dp->next+i)%m->module_devices_size;
+			if(m->module_inflight > 0 && pending[j] >= m->module_inflight) {
+				continue;
+			}
+			if(!(d = desire_waiting(m->module_devices[j]))) {
+				continue;
+			}
+			
+			d->queued 			= 0;
+			d->sending 			= 1;
+			d->sent 			= d->value;
+			d->sent_done 		= d->done;
+			d->sent_userdata 	= d->userdata;
+			
+			ids[k] 		= d->feature;
+			values[k] 	= d->value;
+			k++;
+			
+			pending[j]++;
+			progress = 1;
+		}
+	}
+	
+	if(m->module_devices_size) {
+		dp->next = (dp->next+1)%m->module_devices_size;
+	}
+	if(m->module_rate > 0) {
+		dp->credit -= 1000LL*k;
+	}
+	
+	/* values left over have to wait for the rate or a completion */
+	for(wait=-1,j=0;!k && m->module_rate > 0 && j<m->module_devices_size;j++) {
+		if((m->module_inflight <= 0 || pending[j] < m->module_inflight) && desire_waiting(m->module_devices[j])) {
+			wait = (1000-dp->credit+m->module_rate-1)/m->module_rate;
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	/* values desired meanwhile are picked up by another round */
+	desire_notify(notices,c);
+	if(c) {
+		wait = 0;
+	}
+	
+	if(k) {
+		sent = sharcs_module_set_batch(m,ids,values,k,&desire_done,NULL);
+		
+		pthread_mutex_lock(&mutex_profile);
+		
+		for(c=0,i=sent;i<k;i++) {
+			if((j = desire_find(ids[i])) < 0) {
+				continue;
+			}
+			d = &desires[j];
+			d->sending = 0;
+			
+			if(d->sent_done) {
+				notices[c].feature 	= d->feature;
+				notices[c].done 	= d->sent_done;
+				notices[c].userdata = d->sent_userdata;
+				notices[c].result 	= SHARCS_COMPLETE_FAILED;
+				c++;
+			}
+		}
+		
+		pthread_mutex_unlock(&mutex_profile);
+		
+		desire_notify(notices,c);
+		
+		wait = 0;
+	}
+	
+	free(notices);
+	free(ids);
+	free(values);
+	free(pending);
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	return wait;
+}
+
+void* dispatcher_run(void *arg) {
+	struct dispatcher *dp;
+	struct timespec ts;
+	long long wait;
+	
+	dp = (struct dispatcher*)arg;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	while(!dispatchers_stop) {
+		wait = dispatcher_issue(dp);
+		if(!wait || dispatchers_stop) {
+			continue;
+		}
+		
+		if(wait < 0) {
+			pthread_cond_wait(&desire_cond,&mutex_profile);
+		} else {
+			clock_gettime(CLOCK_REALTIME,&ts);
+			ts.tv_sec 	+= wait/1000;
+			ts.tv_nsec 	+= (wait%1000)*1000000;
+			if(ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&desire_cond,&mutex_profile,&ts);
+		}
+	}
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	return NULL;
+}
+
+/* records the values, the caller holds mutex_profile. returns the number of notices (up to 2n) */
+int desire_add(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata,struct desire_notice *notices) {
+	struct desire *d;
+	int i,j,c;
+	
+	for(c=0,i=0;i<n;i++) {
+		if((j = desire_find(features[i])) < 0) {
+			j = desires_size++;
+			desires = (struct desire*)realloc(desires,sizeof(struct desire)*desires_size);
 			
-			profiles[i] = profile;
+			memset(&desires[j],0,sizeof(struct desire));
+			desires[j].feature 	= features[i];
+			desires[j].module 	= m;
 		}
+		d = &desires[j];
 		
-		packet_delete(p);
+		if(d->queued && d->done) {
+			notices[c].feature 	= d->feature;
+			notices[c].done 	= d->done;
+			notices[c].userdata = d->userdata;
+			notices[c].result 	= SHARCS_COMPLETE_SUPERSEDED;
+			c++;
+		}
+		
+		d->value 	= values[i];
+		d->queued 	= 1;
+		d->done 	= done;
+		d->userdata = userdata;
+		
+		notices[c].feature 	= d->feature;
+		notices[c].done 	= NULL;
+		c++;
 	}
+	
+	pthread_cond_broadcast(&desire_cond);
+	
+	return c;
 }
 
+/*
+ * makes the values desired, the dispatcher of module m passes them once no
+ * other set of the feature is pending. values still waiting are superseded.
+ * never calls into the module, done is called once for each value.
+ */
+int sharcs_desire(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata) {
+	struct desire_notice *notices;
+	int c;
+	
+	notices = (struct desire_notice*)malloc(sizeof(struct desire_notice)*n*2);
+	
+	pthread_mutex_lock(&mutex_profile);
+	c = desire_add(m,features,values,n,done,userdata,notices);
+	pthread_mutex_unlock(&mutex_profile);
+	
+	desire_notify(notices,c);
+	free(notices);
+	
+	return n;
+}
 
-void profile_advance() {
-	struct sharcs_profile *p;
-	int i,r;
+/* latest value set for the feature, SHARCS_VALUE_UNKNOWN if it is settled */
+int sharcs_feature_desired(sharcs_id feature) {
+	int i,value;
 	
-	p = profile_pending;
-	i = profile_queue;
+	pthread_mutex_lock(&mutex_profile);
+	i 		= desire_find(feature);
+	value 	= i < 0 ? SHARCS_VALUE_UNKNOWN : desires[i].value;
+	pthread_mutex_unlock(&mutex_profile);
 	
-	while(i<p->profile_size) {
-		fprintf(stdout,"[Profile] step %d/%d\n",i+1,p->profile_size);
+	return value;
+}
+
+int sharcs_tick() {
+	long long now,next;
+	int i;
 	
-		profile_queue = i+1;
-		
-		if((r=sharcs_set_i(p->profile_features[i],p->profile_values[i])) == 1) {
-			return;
+	now 	= sharcs_now();
+	next 	= completion_expire(now);
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	for(i=0;i<warmups_size;) {
+		if(warmups[i].deadline <= now) {
+			device_ready(warmups[i].device);
+			continue;
 		}
-		
-		/* invalid value for feature.. cancel profile */ 
-		if(r==0) {
-			sharcs_connection_profile(p->profile_id,SHARCS_PROFILE_FAILED);
-			fprintf(stdout,"[Profile] failed at step %d/%d!\n",i+1,p->profile_size);
-			profile_pending = NULL;
-			return;
-		} else if(r==EACTIVE) {
-			fprintf(stdout,"[Profile] step %d/%d skipped!\n",i+1,p->profile_size);
+		if(next < 0 || warmups[i].deadline < next) {
+			next = warmups[i].deadline;
 		}
 		i++;
 	}
 	
-	if(i>=p->profile_size) {
-		sharcs_connection_profile(p->profile_id,SHARCS_PROFILE_LOADED);
-		fprintf(stdout,"[Profile] finished!\n");
-		profile_pending = NULL;
-	}
+	pthread_mutex_unlock(&mutex_profile);
+	
+	profile_flush();
+	
+	return next < 0 ? -1 : (int)(next-now);
 }
 
 /*-----------------------------------
@@ -284,6 +1290,7 @@ int sharcs_profile_save(struct sharcs_profile *profile) {
 			if(profiles[i]->profile_id == profile->profile_id) {
 				
 				if(profiles[i] == profile_pending) {
+					pthread_mutex_unlock(&mutex_profile);
 					return 0;
 				}
 				
@@ -294,6 +1301,7 @@ int sharcs_profile_save(struct sharcs_profile *profile) {
 				free(profiles[i]->profile_features);
 				free(profiles[i]->profile_values);
 				free(profiles[i]);
+				profile_plan_delete(profile_plans[i]);
 				break;
 			}
 		}
@@ -303,9 +1311,11 @@ int sharcs_profile_save(struct sharcs_profile *profile) {
 	if(i>=profiles_size) {
 		profiles_size++;
 		profiles = (struct sharcs_profile**)realloc(profiles,sizeof(struct sharcs_profile*)*profiles_size);
+		profile_plans = (struct profile_plan**)realloc(profile_plans,sizeof(struct profile_plan*)*profiles_size);
 	}
 	
 	profiles[i] = profile;
+	profile_plans[i] = profile_compile(profile);
 	
 	profiles_save();
 
@@ -316,6 +1326,8 @@ int sharcs_profile_save(struct sharcs_profile *profile) {
 
 int sharcs_profile_load(int profile_id) {
 	struct sharcs_profile *p;
+	struct profile_plan *plan;
+	int i;
 	
 	if(profile_pending || !(p = sharcs_profile(profile_id))) {
 		return 0;
@@ -329,20 +1341,136 @@ int sharcs_profile_load(int profile_id) {
 	
 	pthread_mutex_lock(&mutex_profile);
 	
-	profile_queue 	= 0;
-	profile_pending = p;
+	plan = profile_plan(p);
+	if(!plan || plan->failed>=0) {
+		fprintf(stdout,"[Profile] invalid step %d in profile %d\n",plan?plan->failed+1:0,profile_id);
+		pthread_mutex_unlock(&mutex_profile);
+		return 0;
+	}
+	
+	profile_pending 		= p;
+	profile_plan_pending 	= plan;
+	profile_serial++;
+	profile_lanes 			= (struct profile_lane*)malloc(sizeof(struct profile_lane)*plan->devices_size);
+	
+	for(i=0;i<plan->devices_size;i++) {
+		profile_lanes[i].next 		= plan->devices[i];
+		profile_lanes[i].end 		= i+1<plan->devices_size ? plan->devices[i+1] : plan->steps_size;
+		profile_lanes[i].waiting 	= 0;
+		profile_lanes[i].retries 	= 0;
+	}
 	
+	profile_report(p->profile_id,SHARCS_PROFILE_LOADING);
 	profile_advance();
 	
 	pthread_mutex_unlock(&mutex_profile);
 	
-	if(profile_pending) {
-		sharcs_connection_profile(p->profile_id,SHARCS_PROFILE_LOADING);
-	}
+	profile_flush();
 	
 	return 1;
 }
 
+void profile_capture_feature(struct sharcs_profile *profile,struct sharcs_feature *f) {
+	int i,v;
+	
+	v = feature_value(f);
+	if(v == SHARCS_VALUE_UNKNOWN || !feature_valid(f,v)) {
+		return;
+	}
+	
+	for(i=0;i<profile->profile_size;i++) {
+		if(profile->profile_features[i] == f->feature_id) {
+			return;
+		}
+	}
+	
+	profile->profile_size++;
+	profile->profile_features 	= (int*)realloc(profile->profile_features,sizeof(int)*profile->profile_size);
+	profile->profile_values 	= (int*)realloc(profile->profile_values,sizeof(int)*profile->profile_size);
+	
+	profile->profile_features[i] 	= f->feature_id;
+	profile->profile_values[i] 		= v;
+}
+
+void profile_capture_device(struct sharcs_profile *profile,struct sharcs_device *d) {
+	struct sharcs_feature *f;
+	int i;
+	
+	/* devices in standby only get switched off */
+	for(i=0;i<d->device_features_size;i++) {
+		f = d->device_features[i];
+		if((f->feature_flags & SHARCS_FLAG_POWER) && f->feature_type == SHARCS_FEATURE_SWITCH && SHARCS_V_SWITCH(f) == 0) {
+			profile_capture_feature(profile,f);
+			return;
+		}
+	}
+	
+	for(i=0;i<d->device_features_size;i++) {
+		profile_capture_feature(profile,d->device_features[i]);
+	}
+}
+
+/*
+ * creates or replaces a profile with the current values of the given modules,
+ * devices or features. if no name is given the name of the existing profile is kept.
+ */
+struct sharcs_profile* sharcs_profile_capture(int profile_id,const char *name,sharcs_id *ids,int n) {
+	struct sharcs_profile *profile,*existing;
+	struct sharcs_module *m;
+	struct sharcs_device *d;
+	struct sharcs_feature *f;
+	int i,j;
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	existing = profile_id ? sharcs_profile(profile_id) : NULL;
+	if((profile_id && !existing) || (!existing && !name[0])) {
+		pthread_mutex_unlock(&mutex_profile);
+		return NULL;
+	}
+	
+	profile = (struct sharcs_profile*)malloc(sizeof(struct sharcs_profile));
+	profile->profile_id 		= profile_id;
+	profile->profile_name 		= strdup(name[0] ? name : existing->profile_name);
+	profile->profile_size 		= 0;
+	profile->profile_features 	= NULL;
+	profile->profile_values 	= NULL;
+	
+	for(i=0;i<n;i++) {
+		switch(SHARCS_ID_TYPE(ids[i])) {
+			case SHARCS_MODULE:
+				if((m = sharcs_module(ids[i]))) {
+					for(j=0;j<m->module_devices_size;j++) {
+						profile_capture_device(profile,m->module_devices[j]);
+					}
+				}
+				break;
+			case SHARCS_DEVICE:
+				if((d = sharcs_device(ids[i]))) {
+					profile_capture_device(profile,d);
+				}
+				break;
+			case SHARCS_FEATURE:
+				if((f = sharcs_feature(ids[i]))) {
+					profile_capture_feature(profile,f);
+				}
+				break;
+		}
+	}
+	
+	if(!sharcs_profile_save(profile)) {
+		free((void*)profile->profile_name);
+		free(profile->profile_features);
+		free(profile->profile_values);
+		free(profile);
+		profile = NULL;
+	}
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	return profile;
+}
+
 int sharcs_profile_delete(int profile_id) {
 	int i,res;
 	
@@ -353,22 +1481,25 @@ int sharcs_profile_delete(int profile_id) {
 		if(profiles[i]->profile_id == profile_id) {
 	
 			if(profiles[i] == profile_pending) {
-				return 0;
+				break;
 			}
 			
 			free((void*)profiles[i]->profile_name);
 			free(profiles[i]->profile_features);
 			free(profiles[i]->profile_values);
 			free(profiles[i]);
+			profile_plan_delete(profile_plans[i]);
 			
 			fprintf(stdout,"[Profile] deleted profile with id %d\n",profile_id);
 
 			profiles_size--;
 			for(;i<profiles_size;i++) {
 				profiles[i] = profiles[i+1];
+				profile_plans[i] = profile_plans[i+1];
 			}
 			
 			profiles = (struct sharcs_profile**)realloc(profiles,sizeof(struct sharcs_profile*)*profiles_size);
+			profile_plans = (struct profile_plan**)realloc(profile_plans,sizeof(struct profile_plan*)*profiles_size);
 			
 			profiles_save();
 
@@ -382,64 +1513,179 @@ int sharcs_profile_delete(int profile_id) {
 	return res;
 }
 
-int sharcs_set_i(sharcs_id feature,int value) {
+int feature_valid(struct sharcs_feature *f,int value) {
+	switch(f->feature_type) {
+		case SHARCS_FEATURE_ENUM:
+			return value>=0 && value<f->feature_value.v_enum.size;
+		case SHARCS_FEATURE_SWITCH:
+			return value>=0 && value<=1;
+		case SHARCS_FEATURE_RANGE:
+			return value>=f->feature_value.v_range.start && value<=f->feature_value.v_range.end;
+	}
+	return 0;
+}
+
+int feature_value(struct sharcs_feature *f) {
+	switch(f->feature_type) {
+		case SHARCS_FEATURE_ENUM:
+			return SHARCS_V_ENUM(f);
+		case SHARCS_FEATURE_SWITCH:
+			return SHARCS_V_SWITCH(f);
+		case SHARCS_FEATURE_RANGE:
+			return SHARCS_V_RANGE(f);
+	}
+	return SHARCS_VALUE_UNKNOWN;
+}
+
+int sharcs_set_i(sharcs_id feature,int value,void (*done)(sharcs_id,int,void*),void *userdata) {
 	struct sharcs_module *m;
 	struct sharcs_feature *f;
+	int desired;
 	
 	m = sharcs_module(feature);
 	if(!m || !(f=sharcs_feature(feature))) {
 		return 0;
 	}
 	
+	/* check if value is already set or about to be */
+	if((desired = sharcs_feature_desired(feature)) == SHARCS_VALUE_UNKNOWN) {
+		desired = feature_value(f);
+	}
+	if(desired==value) {
+		return EACTIVE;
+	}
+	
+	/* validate value */
+	if(!feature_valid(f,value)) {
+		fprintf(stderr,"value out of bounds for feature '%s'\n",f->feature_name);
+		return 0;
+	}
+	
 	/* better debug output */
-	switch(f->feature_type) {
-		case SHARCS_FEATURE_ENUM:
-			/* check if value is already set */
-			if(SHARCS_V_ENUM(f)==value) {
-				return EACTIVE;
-			}
-			
-			/* validate value */
-			if(value<0||value>=f->feature_value.v_enum.size) {
-				fprintf(stderr,"value of of bounds for enum '%s'\n",f->feature_name);
-				return 0;
+	if(f->feature_type == SHARCS_FEATURE_ENUM) {
+		fprintf(stdout,">> set feature '%s' to '%s'\n",f->feature_name,f->feature_value.v_enum.values[value]);
+	} else {
+		fprintf(stdout,">> set feature '%s' to '%d'\n",f->feature_name,value);
+	}
+	
+	return sharcs_desire(m,&feature,&value,1,done,userdata);
+}
+
+/*
+ * applies op to the desired value of the feature, the reported one if there
+ * is none, and makes the result desired in the same step. concurrent ops
+ * build on each other. returns 0 if op does not apply to the feature or the
+ * comparison failed, EACTIVE if the value would not change.
+ */
+int sharcs_feature_op(sharcs_id feature,int op,int argument,int expected,void (*done)(sharcs_id,int,void*),void *userdata) {
+	struct desire_notice notices[2];
+	struct sharcs_module *m;
+	struct sharcs_feature *f;
+	int current,value,range,c;
+	
+	m = sharcs_module(feature);
+	if(!m || !(f=sharcs_feature(feature))) {
+		return 0;
+	}
+	
+	pthread_mutex_lock(&mutex_profile);
+	
+	if((current = sharcs_feature_desired(feature)) == SHARCS_VALUE_UNKNOWN) {
+		current = feature_value(f);
+	}
+	
+	value = SHARCS_VALUE_ERROR;
+	switch(op) {
+		case SHARCS_OP_ADD:
+			if(f->feature_type == SHARCS_FEATURE_RANGE) {
+				/* the argument comes from clients, no step exceeds the range */
+				range = f->feature_value.v_range.end-f->feature_value.v_range.start;
+				if(argument > range) {
+					argument = range;
+				} else if(argument < -range) {
+					argument = -range;
+				}
+				value = current+argument;
+				if(value < f->feature_value.v_range.start) {
+					value = f->feature_value.v_range.start;
+				} else if(value > f->feature_value.v_range.end) {
+					value = f->feature_value.v_range.end;
+				}
 			}
-			
-			fprintf(stdout,">> set feature '%s' to '%s'\n",f->feature_name,f->feature_value.v_enum.values[value]);
 			break;
-		case SHARCS_FEATURE_SWITCH:
-			/* check if value is already set */
-			if(SHARCS_V_SWITCH(f)==value) {
-				return EACTIVE;
-			}
-			/* validate value */
-			if(value<0||value>1) {
-				fprintf(stderr,"value out of bounds for switch '%s'\n",f->feature_name);
-				return 0;
+		case SHARCS_OP_NEXT:
+			if(f->feature_type == SHARCS_FEATURE_ENUM && f->feature_value.v_enum.size > 0) {
+				value = (current+argument%f->feature_value.v_enum.size)%f->feature_value.v_enum.size;
+				if(value < 0) {
+					value += f->feature_value.v_enum.size;
+				}
 			}
-			
-			fprintf(stdout,">> set feature '%s' to '%d'\n",f->feature_name,value);
 			break;
-		case SHARCS_FEATURE_RANGE:
-			/* check if value is already set */
-			if(SHARCS_V_RANGE(f)==value) {
-				return EACTIVE;
+		case SHARCS_OP_TOGGLE:
+			if(f->feature_type == SHARCS_FEATURE_SWITCH) {
+				value = !current;
 			}
-		
-			/* validate value */
-			if(value<f->feature_value.v_range.start||value>f->feature_value.v_range.end) {
-				fprintf(stderr,"value of of bounds for range '%s'\n",f->feature_name);
-				return 0;
+			break;
+		case SHARCS_OP_CAS:
+			if(current == expected) {
+				value = argument;
 			}
-			
-			fprintf(stdout,">> set feature '%s' to '%d'\n",f->feature_name,value);
 			break;
-		default:
-			fprintf(stderr,"unknown feature type '%d'\n",f->feature_type);
-			return 0;
 	}
 	
-	return m->module_set_i(feature,value);
+	/* nothing known to build on */
+	if(current == SHARCS_VALUE_UNKNOWN || value == SHARCS_VALUE_ERROR || !feature_valid(f,value)) {
+		pthread_mutex_unlock(&mutex_profile);
+		return 0;
+	}
+	
+	if(value == current) {
+		pthread_mutex_unlock(&mutex_profile);
+		return EACTIVE;
+	}
+	
+	fprintf(stdout,">> set feature '%s' to '%d' (op %d)\n",f->feature_name,value,op);
+	
+	c = desire_add(m,&feature,&value,1,done,userdata,notices);
+	
+	pthread_mutex_unlock(&mutex_profile);
+	
+	desire_notify(notices,c);
+	
+	return 1;
+}
+
+/*
+ * passes the values to the module at once, one by one for modules
+ * without module_set_batch. returns the number of values accepted,
+ * done is called once for each of them when the set completed
+ */
+int sharcs_module_set_batch(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata) {
+	sharcs_token *tokens;
+	int i,accepted;
+	
+	/* registered first, modules may complete before returning */
+	tokens = (sharcs_token*)malloc(sizeof(sharcs_token)*n);
+	for(i=0;i<n;i++) {
+		tokens[i] = completion_add(features[i],values[i],!m->module_set_batch,done,userdata);
+	}
+	
+	if(m->module_set_batch) {
+		accepted = m->module_set_batch(features,values,tokens,n);
+	} else {
+		for(accepted=0;accepted<n;accepted++) {
+			if(m->module_set_i(features[accepted],values[accepted]) != 1) {
+				break;
+			}
+		}
+	}
+	
+	for(i=accepted;i<n;i++) {
+		completion_drop(tokens[i]);
+	}
+	free(tokens);
+	
+	return accepted;
 }
 
 int sharcs_set_s(sharcs_id feature,const char* value) {
@@ -461,65 +1707,126 @@ int sharcs_set_s(sharcs_id feature,const char* value) {
 	 */
 }
 
-void sharcs_callback_feature(sharcs_id id,void *v) {
+/* applies a value reported by a module, returns 0 if nothing has to be propagated */
+int value_update(sharcs_id id,int v) {
 	struct sharcs_feature *f;
-	int i = 0;
+	struct sharcs_device *d;
+	
+	/* device state reported by module */
+	if(SHARCS_ID_TYPE(id) == SHARCS_DEVICE) {
+		if((d = sharcs_device(id))) {
+			if(v & SHARCS_FLAG_WARMUP) {
+				device_warmup_start(d);
+			} else {
+				device_ready(d);
+			}
+		}
+		return 0;
+	}
 	
 	f = sharcs_feature(id);
 	if(f) {
 		switch(f->feature_type) {
 		case SHARCS_FEATURE_ENUM:
-			fprintf(stdout,"<< feature '%s' changed to '%s'\n",f->feature_name,f->feature_value.v_enum.values[*((int*)v)]);
-			f->feature_value.v_enum.value = *((int*)v);
+			fprintf(stdout,"<< feature '%s' changed to '%s'\n",f->feature_name,f->feature_value.v_enum.values[v]);
+			f->feature_value.v_enum.value = v;
 			break;
 		case SHARCS_FEATURE_SWITCH:
 			if(f->feature_flags & SHARCS_FLAG_POWER) {
-				if(!*((int*)v)) {
-					sharcs_device(id)->device_flags |= SHARCS_FLAG_STANDBY;
+				d = sharcs_device(id);
+				
+				/* device_flags are shared with the warm-up timers */
+				pthread_mutex_lock(&mutex_profile);
+				if(!v) {
+					d->device_flags |= SHARCS_FLAG_STANDBY;
+					device_ready(d);
 				} else {
-					sharcs_device(id)->device_flags &= ~SHARCS_FLAG_STANDBY;
+					d->device_flags &= ~SHARCS_FLAG_STANDBY;
+					if(f->feature_value.v_switch.state == 0) {
+						device_warmup_start(d);
+					}
 				}
+				pthread_mutex_unlock(&mutex_profile);
 			}
-			fprintf(stdout,"<< feature '%s' changed to '%d'\n",f->feature_name,*((int*)v));
-			f->feature_value.v_switch.state = *((int*)v);
+			fprintf(stdout,"<< feature '%s' changed to '%d'\n",f->feature_name,v);
+			f->feature_value.v_switch.state = v;
 			break;
 		case SHARCS_FEATURE_RANGE:
-			fprintf(stdout,"<< feature '%s' changed to '%d'\n",f->feature_name,*((int*)v));
-			f->feature_value.v_range.value = *((int*)v);
+			fprintf(stdout,"<< feature '%s' changed to '%d'\n",f->feature_name,v);
+			f->feature_value.v_range.value = v;
 			break;
 		}
 	}
 	
-	if(profile_pending) { 
-		/* @TODO missing some kind of tick, to handle timeouts...?! */
-		pthread_mutex_lock(&mutex_profile);
-		
-		if(profile_pending && id == profile_pending->profile_features[profile_queue-1]) {
-			
-			if(*((int*)v) == profile_pending->profile_values[profile_queue-1]) {
-				profile_advance();
-			} else {
-				sharcs_set_i(profile_pending->profile_features[profile_queue-1],
-					profile_pending->profile_values[profile_queue-1]);
-			}
+	return 1;
+}
+
+/* callback of ABI v2 modules */
+void sharcs_callback_values(const struct sharcs_value *values,int n) {
+	int i;
+	
+	for(i=0;i<n;i++) {
+		if(!value_update(values[i].id,values[i].value)) {
+			continue;
 		}
 		
-		pthread_mutex_unlock(&mutex_profile);
+		completion_report(values[i].id,values[i].value);
+		
+		/* notify connection handler */
+		sharcs_connection_feature(values[i].id);
+		
+		groups_member(values[i].id,values[i].value);
+	}
+	
+	/* devices which became ready resume the pending profile */
+	profile_flush();
+}
+
+void sharcs_callback_feature(sharcs_id id,void *v) {
+	struct sharcs_value value;
+	
+	value.id 	= id;
+	value.value = *((int*)v);
+	
+	sharcs_callback_values(&value,1);
+}
+
+/* starts an initialized module, the last slot. it is released if the module fails to start */
+int module_attach(struct sharcs_module *module,void *lib_handle) {
+	int i;
+	
+	i = module-modules;
+	
+	fprintf(stdout,"Initializing module '%s' with %d devices...\n",module->module_name,module->module_devices_size);
+	
+	if(!module->module_start()) {
+		fprintf(stderr,"error starting module '%s'\n",module->module_name);
+		modules_size--;
+		return 0;
 	}
 	
+	modules_lib_handle[i] = lib_handle;
+	
+	/* sets are passed to the module by its own thread */
+	dispatchers[i].module = module;
+	pthread_create(&dispatchers[i].thread,NULL,&dispatcher_run,&dispatchers[i]);
 	
-	/* notify connection handler */
-	sharcs_connection_feature(id);
+	/* compiled profiles need to be resolved again */
+	schema_generation++;
+	
+	return module->module_id;
 }
 
 int sharcs_module_load(const char *module_name) {
 	void *lib_handle;
 	char *error,*file;
 	int (*fn)(struct sharcs_module *mod, void (*cb)(sharcs_id,void*));
+	int (*fn2)(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int));
 	int r;
 	
 	struct sharcs_module *module;
 	module = &modules[modules_size++];
+	memset(module,0,sizeof(struct sharcs_module));
 	module->module_id = SHARCS_ID_MODULE_MAKE(modules_size);
 	
 	file = (char*)malloc(sizeof(char)*(strlen(module_name)+strlen(path_binary)+2));
@@ -531,36 +1838,79 @@ int sharcs_module_load(const char *module_name) {
 	
 	if (!lib_handle)  {
 		fprintf(stderr, "%s\n", dlerror());
+		modules_size--;
 		return 0;
 	}
 
-	fn = dlsym(lib_handle, "sharcs_init");
-	if ((error = dlerror()) != NULL) {
-		fprintf(stderr, "%s\n", error);
-		return 0;
+	/* prefer the batched interface, fall back to single values */
+	dlerror();
+	fn2 = dlsym(lib_handle, "sharcs_init_v2");
+	if (dlerror() == NULL && fn2) {
+		modules_abi[module-modules] = SHARCS_MODULE_ABI;
+		r = (*fn2)(module,&sharcs_callback_values,&sharcs_complete);
+	} else {
+		modules_abi[module-modules] = 1;
+		fn = dlsym(lib_handle, "sharcs_init");
+		if ((error = dlerror()) != NULL) {
+			fprintf(stderr, "%s\n", error);
+			dlclose(lib_handle);
+			modules_size--;
+			return 0;
+		}
+		
+		r = (*fn)(module,&sharcs_callback_feature);
 	}
-
-	r = (*fn)(module,&sharcs_callback_feature);
+	
 	if(!r) {
 		fprintf(stderr,"error loading module '%s'\n",module_name);
+		dlclose(lib_handle);
+		modules_size--;
 		return 0;
 	}
 	
-	fprintf(stdout,"Initializing module '%s' with %d devices...\n",module->module_name,module->module_devices_size);
+	if(!(r = module_attach(module,lib_handle))) {
+		dlclose(lib_handle);
+	}
+	
+	return r;
+}
+
+/* modules part of sharcsd, init returns 0 if the module has nothing to offer */
+int sharcs_module_builtin(int (*init)(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int))) {
+	struct sharcs_module *module;
 	
-	r = module->module_start();
+	module = &modules[modules_size++];
+	memset(module,0,sizeof(struct sharcs_module));
+	module->module_id = SHARCS_ID_MODULE_MAKE(modules_size);
+	modules_abi[module-modules] = SHARCS_MODULE_ABI;
 	
-	modules_lib_handle[modules_size-1] = lib_handle;
+	if(!init(module,&sharcs_callback_values,&sharcs_complete)) {
+		modules_size--;
+		return 0;
+	}
 	
-	return module->module_id;
+	return module_attach(module,NULL);
 }
 
 void sharcs_shutdown() {
 	int i;
 	
+	pthread_mutex_lock(&mutex_profile);
+	dispatchers_stop = 1;
+	pthread_cond_broadcast(&desire_cond);
+	pthread_mutex_unlock(&mutex_profile);
+	
+	for(i=0;i<modules_size;i++) {
+		if(dispatchers[i].module) {
+			pthread_join(dispatchers[i].thread,NULL);
+		}
+	}
+	
 	for(i=0;i<modules_size;i++) {
 		modules[i].module_stop();
-		dlclose(modules_lib_handle[i]);
+		if(modules_lib_handle[i]) {
+			dlclose(modules_lib_handle[i]);
+		}
 	}
 }
 
@@ -641,8 +1991,14 @@ int main(int argc, char **argv) {
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); 
 	pthread_mutex_init(&mutex_profile, &attr);
 	
-	profiles 		= 0;
-	profiles_size 	= 0;
+	profiles 			= 0;
+	profile_plans 		= 0;
+	profiles_size 		= 0;
+	warmups 			= 0;
+	warmups_size 		= 0;
+	completions 		= 0;
+	completions_size 	= 0;
+	schema_generation 	= 0;
 	
 	profiles_load();
 
@@ -653,10 +2009,15 @@ int main(int argc, char **argv) {
 	
 	sharcs_module_load("mod_cul.so");
 	sharcs_module_load("mod_onkyo_av.so");
+	
+	/* groups refer to features of the modules loaded before */
+	sharcs_module_builtin(&groups_init);
 /*	sharcs_module_load("mod_stub.so");
 	sharcs_module_load("mod_stub2.so");
 	sharcs_module_load("mod_stub3.so");
 */	
+	profiles_compile();
+	
 	sharcs_connection_start();
 	
 	/* will only return here on error*/
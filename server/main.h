@@ -1,15 +1,26 @@
 #ifndef _MAIN_H_
 #define _MAIN_H_
 
-int sharcs_enumerate_module(struct sharcs_module **module,int index);
+int sharcs_enumerate_modules(struct sharcs_module **module,int index);
 
 struct sharcs_module* sharcs_module(sharcs_id id);
 struct sharcs_device* sharcs_device(sharcs_id id);
 struct sharcs_feature* sharcs_feature(sharcs_id id);
 struct sharcs_profile* sharcs_profile(int id);
 
-int sharcs_set_i(sharcs_id feature,int value);
+/* done is called with a SHARCS_COMPLETE_* result once the set completed, it may be NULL */
+int sharcs_set_i(sharcs_id feature,int value,void (*done)(sharcs_id feature,int result,void *userdata),void *userdata);
 int sharcs_set_s(sharcs_id feature,const char* value);
+/* SHARCS_OP_*, applied atomically to the desired value */
+int sharcs_feature_op(sharcs_id feature,int op,int argument,int expected,void (*done)(sharcs_id,int,void*),void *userdata);
+int sharcs_module_set_batch(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata);
+
+/*
+ * sets are collapsed per feature and passed to the module by its dispatcher,
+ * only the latest value is passed once the module is free
+ */
+int sharcs_desire(struct sharcs_module *m,const sharcs_id *features,const int *values,int n,void (*done)(sharcs_id,int,void*),void *userdata);
+int sharcs_feature_desired(sharcs_id feature);
 
 /* profiles */
 int sharcs_enumerate_profiles(struct sharcs_profile **profile,int index);
@@ -17,5 +28,9 @@ int sharcs_enumerate_profiles(struct sharcs_profile **profile,int index);
 int sharcs_profile_save(struct sharcs_profile *profile);
 int sharcs_profile_load(int profile_id);
 int sharcs_profile_delete(int profile_id);
+struct sharcs_profile* sharcs_profile_capture(int profile_id,const char *name,sharcs_id *ids,int n);
+
+/* handles timers, returns milliseconds until next call is required or -1 */
+int sharcs_tick();
 
 #endif
\ No newline at end of file
@@ -18,105 +18,554 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "../../../sharcs.h"
 #include "../../tty.h"
 
-int module_id, device_id;
-void (*sharcs_callback)(sharcs_id,void*);
-pthread_t thread_handle;
-int thread_stop;
-TTYCTX tty_ctx;
+int module_id;
+void (*sharcs_callback)(const struct sharcs_value*,int);
+void (*sharcs_complete)(sharcs_token,int);
 
-void tty_callback(const char *s, int len) {
+/*------------------------------------------------------
+ * FS20
+ *
+ * frames are reported by the CUL as "F" followed by the
+ * housecode (4 hex digits), the address, the command and,
+ * if bit 0x20 of the command is set, an extension byte.
+ *------------------------------------------------------*/
+
+enum {
+	FS20_OFF		= 0x00,
+	FS20_DIM_MAX	= 0x10,
+	FS20_ON			= 0x11,
+	FS20_TOGGLE		= 0x12,
+	FS20_EXTENSION	= 0x20,
+};
+
+struct fs20_frame {
+	unsigned int housecode;
+	unsigned char address, command, ext;
+};
+
+/* senders repeat every frame, identical frames within this window (ms) are dropped */
+#define FS20_REPEAT_WINDOW 500
+
+/*
+ * 868MHz devices may transmit 1% of the time. the budget is tracked as
+ * airtime credit (ms) that refills at 10ms per second up to 36s, the
+ * same accounting the CUL firmware applies before it refuses to send.
+ */
+#define FS20_AIRTIME 250
+#define FS20_CREDIT_MAX 36000
+#define FS20_CREDIT_RATE 100
+
+/* frames that would wait longer than this (ms) for credit are refused */
+#define FS20_MAX_DELAY 30000
+
+int fs20_hex(const char *s,int n,unsigned int *v) {
+	int i,c;
+	
+	for(*v=0,i=0;i<n;i++) {
+		c = s[i];
+		if(c >= '0' && c <= '9') {
+			c -= '0';
+		} else if(c >= 'A' && c <= 'F') {
+			c -= 'A'-10;
+		} else if(c >= 'a' && c <= 'f') {
+			c -= 'a'-10;
+		} else {
+			return 0;
+		}
+		*v = (*v<<4)|c;
+	}
+	return 1;
+}
+
+/*
+ * decodes a received frame, returns 0 if s is no FS20 frame
+ */
+int fs20_decode(const char *s,int len,struct fs20_frame *f) {
+	unsigned int v;
+	
+	if(len < 9 || s[0] != 'F') {
+		return 0;
+	}
+	
+	if(!fs20_hex(s+1,4,&f->housecode)) {
+		return 0;
+	}
+	if(!fs20_hex(s+5,2,&v)) {
+		return 0;
+	}
+	f->address = v;
+	if(!fs20_hex(s+7,2,&v)) {
+		return 0;
+	}
+	f->command = v;
+	f->ext = 0;
+	
+	if(f->command & FS20_EXTENSION) {
+		if(len < 11 || !fs20_hex(s+9,2,&v)) {
+			return 0;
+		}
+		f->ext = v;
+	}
+	
+	return 1;
+}
+
+/*------------------------------------------------------
+ * devices
+ *------------------------------------------------------*/
+
+/*
+ * CUL sticks driven by this module, each one is exposed
+ * as a device with its FS20 actors as features
+ */
+struct stick {
+	const char *name;
+	const char *tty;
+	
+	int device_id;
+	TTYCTX tty_ctx;
+	struct actor **actors;
+	int actors_size;
+	
+	// transmit scheduler
+	pthread_mutex_t mutex;
+	long long credit, creditTime;
+	struct actor **queue;
+	int queueCount;
+};
+
+enum {
+	ACTOR_SWITCH,
+	ACTOR_DIMMER,
+};
+
+struct actor {
+	int stick;
+	const char *name;
+	int type;
+	unsigned int housecode;
+	unsigned char address;
+	
+	int feature_id, value;
+	
+	// last received frame, for repeat suppression
+	unsigned char lastCommand, lastExt;
+	long long lastTime;
+	
+	// command waiting for airtime, -1 if none
+	int pending, pendingValue;
+	sharcs_token token;
+};
+
+static struct stick sticks[] = {
+	{"Light", "/dev/tty.usbmodemfa1441"},
+	/* stick at a ser2net port, see tty_init */
+	/* {"Light", "tcp:cellar.local:4002"}, */
+};
+
+static struct actor actors[] = {
+	{0, "Ceiling", 	ACTOR_SWITCH, 0x758F, 0x01},
+	{0, "Desk", 	ACTOR_SWITCH, 0x758F, 0x00},
+};
+
+#define NUM_STICKS (int)(sizeof(sticks)/sizeof(struct stick))
+#define NUM_ACTORS (int)(sizeof(actors)/sizeof(struct actor))
+
+/*
+ * open addressing index from (stick,housecode,address) to actor,
+ * sized to stay at most half full
+ */
+struct actor **actor_index;
+unsigned int actor_index_mask;
+
+static inline unsigned int actor_key(int stick,unsigned int housecode,unsigned char address) {
+	return ((unsigned int)stick<<24)|((housecode&0xFFFF)<<8)|address;
+}
+
+static inline unsigned int actor_slot(unsigned int key) {
+	return (key*2654435761u)&actor_index_mask;
+}
+
+void actor_index_build() {
+	unsigned int size,h;
+	int i;
+	
+	for(size=4;size<2*NUM_ACTORS;size<<=1);
+	
+	actor_index 		= (struct actor**)calloc(size,sizeof(struct actor*));
+	actor_index_mask 	= size-1;
+	
+	for(i=0;i<NUM_ACTORS;i++) {
+		h = actor_slot(actor_key(actors[i].stick,actors[i].housecode,actors[i].address));
+		while(actor_index[h]) {
+			h = (h+1)&actor_index_mask;
+		}
+		actor_index[h] = &actors[i];
+	}
+}
+
+struct actor *actor_lookup(int stick,unsigned int housecode,unsigned char address) {
+	struct actor *a;
+	unsigned int h;
+	
+	for(h=actor_slot(actor_key(stick,housecode,address));(a=actor_index[h]);h=(h+1)&actor_index_mask) {
+		if(a->stick == stick && a->housecode == housecode && a->address == address) {
+			return a;
+		}
+	}
+	return NULL;
+}
+
+long long cul_now() {
+	struct timeval tv;
+	
+	gettimeofday(&tv,NULL);
+	
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+/*
+ * maps an FS20 command to the feature value of an actor, -1 if it does not change it
+ */
+int actor_value(struct actor *a,unsigned char command) {
+	command &= ~FS20_EXTENSION;
+	
+	if(command == FS20_TOGGLE) {
+		if(a->value>0 && a->value != SHARCS_VALUE_UNKNOWN) {
+			return 0;
+		}
+		return a->type == ACTOR_DIMMER ? FS20_DIM_MAX : 1;
+	}
+	if(command > FS20_ON) {
+		return -1;
+	}
+	if(a->type == ACTOR_DIMMER) {
+		return command == FS20_ON ? FS20_DIM_MAX : command;
+	}
+	return command != FS20_OFF;
+}
+
+void tty_callback(TTYCTX ctx, const char *s, int len) {
+	struct stick *st;
+	struct fs20_frame f;
+	struct actor *a;
+	struct sharcs_value value;
+	long long now;
+	int v;
+	
+	st = (struct stick*)tty_userdata(ctx);
 	
 	fprintf(stdout,"[cul]: %s:%d\n",s,len);
 	
-	int v,i;
-	if(!strcmp(s,"F758F0011\r")) {
-		i = 2;
-		v = 1;
-	} else if(!strcmp(s,"F758F0000\r")) {
-		i = 2;
-		v = 0;
-	} else if(!strcmp(s,"F758F0111\r")) {
-		i = 1;
-		v = 1;
-	} else if(!strcmp(s,"F758F0100\r")) {
-		i = 1;
-		v = 0;
-	} else {
+	if(!fs20_decode(s,len,&f)) {
+		return;
+	}
+	
+	if(!(a = actor_lookup(st-sticks,f.housecode,f.address))) {
+		return;
+	}
+	
+	/* the actor is shared with stick_transmit */
+	pthread_mutex_lock(&st->mutex);
+	
+	/* repeated transmission of the same frame */
+	now = cul_now();
+	if(a->lastTime && now-a->lastTime < FS20_REPEAT_WINDOW && a->lastCommand == f.command && a->lastExt == f.ext) {
+		a->lastTime = now;
+		pthread_mutex_unlock(&st->mutex);
+		return;
+	}
+	a->lastCommand 	= f.command;
+	a->lastExt 		= f.ext;
+	a->lastTime 	= now;
+	
+	if((v = actor_value(a,f.command)) < 0 || v == a->value) {
+		pthread_mutex_unlock(&st->mutex);
 		return;
 	}
-	sharcs_callback(SHARCS_ID_FEATURE_MAKE(module_id,device_id,i),&v);
+	
+	a->value = v;
+	
+	pthread_mutex_unlock(&st->mutex);
+	
+	value.id 	= a->feature_id;
+	value.value = v;
+	sharcs_callback(&value,1);
+}
+
+/*
+ * a stick at a ser2net port is back after the link dropped
+ */
+void tty_link(TTYCTX ctx,int state) {
+	if(state == TTY_CONNECTED) {
+		// activate listening mode again
+		tty_send(ctx,"X01\r\n");
+	}
 }
 
-void *module_thread(void *threadid) {
-	int ret;
+/*------------------------------------------------------
+ * transmit scheduler
+ *------------------------------------------------------*/
+
+void stick_timer(TTYCTX ctx);
+
+void stick_refill(struct stick *st) {
+	long long now = cul_now();
 	
-	ret = 1;
+	st->credit += (now-st->creditTime)/FS20_CREDIT_RATE;
+	if(st->credit > FS20_CREDIT_MAX) {
+		st->credit = FS20_CREDIT_MAX;
+	}
+	/* keep the remainder of partially earned credit */
+	st->creditTime = now-(now-st->creditTime)%FS20_CREDIT_RATE;
+}
+
+/*
+ * sends queued frames while there is credit left, otherwise waits
+ * until enough credit for the next frame has been earned. called
+ * with the stick mutex held, the new values and tokens of the frames
+ * sent are stored in sent and tokens (NUM_ACTORS entries) for
+ * stick_report. returns the number of frames sent.
+ */
+int stick_transmit(struct stick *st,struct sharcs_value *sent,sharcs_token *tokens) {
+	struct actor *a;
+	char buf[32];
+	int n = 0;
+	
+	stick_refill(st);
 	
-	while(!thread_stop && (ret=tty_main(tty_ctx))) {
+	while(st->queueCount>0 && st->credit >= FS20_AIRTIME) {
+		a = st->queue[0];
+		memmove(st->queue,st->queue+1,sizeof(struct actor*)*(st->queueCount-1));
+		st->queueCount--;
+		
+		sprintf(buf,"F%04X%02X%02X\r\n",a->housecode,a->address,a->pending);
+		tty_send(st->tty_ctx,buf);
+		
+		/* FS20 is not acknowledged, the frame on air is all there is */
+		a->value 		= a->pendingValue;
+		sent[n].id 		= a->feature_id;
+		sent[n].value 	= a->pendingValue;
+		tokens[n] 		= a->token;
+		n++;
+		
+		a->pending = -1;
+		st->credit -= FS20_AIRTIME;
 	}
 	
-	if(!ret) {
-		fprintf(stderr,"mod_cul: %s\n",tty_error(tty_ctx));
+	if(st->queueCount>0) {
+		tty_set_timer(st->tty_ctx,(FS20_AIRTIME-st->credit)*FS20_CREDIT_RATE,&stick_timer);
 	}
 	
-	pthread_exit(NULL);
+	return n;
 }
 
-int module_start() {
-	if(thread_handle) {
-		return 0;
-	}
+/* reports frames sent by stick_transmit, called without the stick mutex */
+void stick_report(struct sharcs_value *sent,sharcs_token *tokens,int n) {
+	int i;
 	
-	/* tty mode */
-	if(!(tty_ctx = tty_init_tty("/dev/tty.usbmodemfa1441",&tty_callback))) {
-		fprintf(stderr,"mod_cul: failed to initialize tty\n");
-		return 0;
+	if(n>0) {
+		sharcs_callback(sent,n);
 	}
+	for(i=0;i<n;i++) {
+		sharcs_complete(tokens[i],SHARCS_COMPLETE_OK);
+	}
+}
+
+void stick_timer(TTYCTX ctx) {
+	struct stick *st = (struct stick*)tty_userdata(ctx);
+	struct sharcs_value sent[NUM_ACTORS];
+	sharcs_token tokens[NUM_ACTORS];
+	int n;
 	
-	// activate listening mode
-	tty_send(tty_ctx,"X01\r\n");
+	pthread_mutex_lock(&st->mutex);
+	n = stick_transmit(st,sent,tokens);
+	pthread_mutex_unlock(&st->mutex);
 	
-	thread_stop = 0;
-	pthread_create(&thread_handle, NULL, module_thread, (void *)0);
+	stick_report(sent,tokens,n);
+}
+
+/*
+ * queues a command for an actor. a command still waiting for airtime
+ * is replaced, so only the latest state of an actor is sent, the token
+ * of the replaced one is stored in superseded (0 if none). returns 0
+ * (back-pressure) if the frame would exceed FS20_MAX_DELAY. called
+ * with the stick mutex held, stick_transmit sends the queue.
+ */
+int stick_queue(struct stick *st,struct actor *a,int command,int value,sharcs_token token,sharcs_token *superseded) {
+	long long wait;
+	
+	*superseded = 0;
+	
+	if(a->pending >= 0) {
+		*superseded = a->token;
+	} else {
+		stick_refill(st);
+		
+		wait = ((long long)(st->queueCount+1)*FS20_AIRTIME-st->credit)*FS20_CREDIT_RATE;
+		if(wait > FS20_MAX_DELAY) {
+			fprintf(stderr,"mod_cul: duty cycle budget exhausted, %s refused\n",a->name);
+			return 0;
+		}
+		
+		st->queue[st->queueCount++] = a;
+	}
+	a->pending 		= command;
+	a->pendingValue = value;
+	a->token 		= token;
 	
 	return 1;
 }
 
+int module_start() {
+	struct stick *st;
+	int i,started = 0;
+	
+	for(i=0;i<NUM_STICKS;i++) {
+		st = &sticks[i];
+		if(st->tty_ctx) {
+			continue;
+		}
+		
+		/* tty mode */
+		if(!(st->tty_ctx = tty_init(st->tty,&tty_callback,st))) {
+			fprintf(stderr,"mod_cul: failed to initialize tty %s\n",st->tty);
+			continue;
+		}
+		
+		// culfw terminates its replies with CR LF
+		tty_set_delimiter(st->tty_ctx,"\r\n",2);
+		tty_set_state_callback(st->tty_ctx,&tty_link);
+		
+		// activate listening mode
+		tty_send(st->tty_ctx,"X01\r\n");
+		
+		if(!tty_start(st->tty_ctx)) {
+			fprintf(stderr,"mod_cul: %s\n",tty_error(st->tty_ctx));
+			tty_close(st->tty_ctx);
+			st->tty_ctx = NULL;
+			continue;
+		}
+		started++;
+	}
+	
+	return started>0;
+}
+
 int module_stop() {
-	if(!thread_handle) {
-		return 0;
+	sharcs_token tokens[NUM_ACTORS];
+	int i,j,n,stopped = 0;
+	
+	for(i=0;i<NUM_STICKS;i++) {
+		if(sticks[i].tty_ctx) {
+			pthread_mutex_lock(&sticks[i].mutex);
+			for(n=0;sticks[i].queueCount>0;n++) {
+				sticks[i].queue[--sticks[i].queueCount]->pending = -1;
+				tokens[n] = sticks[i].queue[sticks[i].queueCount]->token;
+			}
+			pthread_mutex_unlock(&sticks[i].mutex);
+			
+			for(j=0;j<n;j++) {
+				sharcs_complete(tokens[j],SHARCS_COMPLETE_FAILED);
+			}
+			
+			tty_close(sticks[i].tty_ctx);
+			sticks[i].tty_ctx = NULL;
+			stopped++;
+		}
 	}
 	
-	thread_stop = 1;
-	pthread_join(0,NULL);
+	return stopped>0;
+}
+
+/*
+ * resolves the actor of a feature and the FS20 command for value, NULL if invalid
+ */
+struct actor *actor_command(sharcs_id feature,int value,int *command) {
+	struct stick *st;
+	struct actor *a;
+	int d,f;
 	
-	tty_stop(tty_ctx);
+	d = SHARCS_INDEX_DEVICE(feature);
+	f = SHARCS_INDEX_FEATURE(feature);
+	if(d < 1 || d > NUM_STICKS || !sticks[d-1].tty_ctx) {
+		return NULL;
+	}
+	st = &sticks[d-1];
+	if(f < 1 || f > st->actors_size) {
+		return NULL;
+	}
+	a = st->actors[f-1];
 	
-	return 1;
+	if(a->type == ACTOR_DIMMER) {
+		if(value < 0 || value > FS20_DIM_MAX) {
+			return NULL;
+		}
+		*command = value;
+	} else {
+		*command = value ? FS20_ON : FS20_OFF;
+	}
+	
+	return a;
 }
 
-int module_set_i(sharcs_id feature, int value) {
-	switch(SHARCS_INDEX_FEATURE(feature)) {
-		case 2:
-			if(value) {
-				tty_send(tty_ctx,"F758F0011\r\n");
-			} else {
-				tty_send(tty_ctx,"F758F0000\r\n");
-			}
+/*
+ * queues all frames before transmitting, so a batch leaves each
+ * stick in one burst. values are reported and completed as their
+ * frames go out, which may be later if the duty cycle is used up.
+ */
+int module_set_batch(const sharcs_id *features, const int *values, const sharcs_token *tokens, int n) {
+	struct sharcs_value sent[NUM_ACTORS];
+	sharcs_token sentTokens[NUM_ACTORS],*superseded;
+	struct stick *st;
+	struct actor *a;
+	int i,j,k,command,queued;
+	
+	superseded = (sharcs_token*)malloc(sizeof(sharcs_token)*n);
+	
+	for(i=0;i<n;i++) {
+		if(!(a = actor_command(features[i],values[i],&command))) {
 			break;
-		case 1:
-			if(value) {
-				tty_send(tty_ctx,"F758F0111\r\n");
-			} else {
-				tty_send(tty_ctx,"F758F0100\r\n");
-			}
+		}
+		st = &sticks[a->stick];
+		
+		pthread_mutex_lock(&st->mutex);
+		queued = stick_queue(st,a,command,values[i],tokens[i],&superseded[i]);
+		pthread_mutex_unlock(&st->mutex);
+		
+		if(!queued) {
 			break;
+		}
 	}
-	sharcs_callback(feature,&value);
-	return 1;
+	
+	for(j=0;j<NUM_STICKS;j++) {
+		st = &sticks[j];
+		
+		pthread_mutex_lock(&st->mutex);
+		k = st->queueCount>0 ? stick_transmit(st,sent,sentTokens) : 0;
+		pthread_mutex_unlock(&st->mutex);
+		
+		stick_report(sent,sentTokens,k);
+	}
+	
+	for(j=0;j<i;j++) {
+		if(superseded[j]) {
+			sharcs_complete(superseded[j],SHARCS_COMPLETE_SUPERSEDED);
+		}
+	}
+	free(superseded);
+	
+	return i;
+}
+
+int module_set_i(sharcs_id feature, int value) {
+	sharcs_token token = 0;
+	
+	return module_set_batch(&feature,&value,&token,1);
 }
 
 int module_set_s(sharcs_id feature, const char *value) {
@@ -127,56 +576,91 @@ int module_set_s(sharcs_id feature, const char *value) {
 extern "C" {
 #endif
 
-int sharcs_init(struct sharcs_module *mod, void (*cb)(sharcs_id,void *v)) {
+int sharcs_init_v2(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int)) {
 	struct sharcs_device *device;
 	struct sharcs_feature *feature;
-	int i = 0;
+	struct actor *a;
+	int i,n;
 	
-	device_id = SHARCS_ID_DEVICE_MAKE(mod->module_id,1);
+	mod->module_devices_size 	= NUM_STICKS;
+	mod->module_devices 		= (struct sharcs_device**)malloc(sizeof(struct sharcs_device*)*NUM_STICKS);
 	
-	thread_handle = 0;
-	
-	/* create device structure */
-	device = (struct sharcs_device*)malloc(sizeof(struct sharcs_device));
-	device->device_id 				= device_id;
-	device->device_name 			= "Light";
-	device->device_description 		= "CULV3";
-	device->device_features_size 	= 2;
-	device->device_features 		= (struct sharcs_feature**)malloc(sizeof(struct sharcs_feature*)*2);
-	
-	for(i=0;i<2;i++) {
-		feature = (struct sharcs_feature*)malloc(sizeof(struct sharcs_feature));
-		feature->feature_id 		= SHARCS_ID_FEATURE_MAKE(mod->module_id,device_id,1+i);
-		feature->feature_flags		= 0;
-		device->device_features[i]	= feature;
+	for(n=0;n<NUM_STICKS;n++) {
+		sticks[n].device_id 	= SHARCS_ID_DEVICE_MAKE(mod->module_id,(n+1));
+		sticks[n].tty_ctx 		= NULL;
+		sticks[n].actors 		= (struct actor**)malloc(sizeof(struct actor*)*NUM_ACTORS);
+		sticks[n].actors_size 	= 0;
+		sticks[n].queue 		= (struct actor**)malloc(sizeof(struct actor*)*NUM_ACTORS);
+		sticks[n].queueCount 	= 0;
+		sticks[n].credit 		= FS20_CREDIT_MAX;
+		sticks[n].creditTime 	= cul_now();
+		pthread_mutex_init(&sticks[n].mutex,NULL);
 		
-		if(i==0) {
-			feature->feature_name = "Ceiling";
-		} else {
-			feature->feature_name = "Desk";
+		/* create device structure */
+		device = (struct sharcs_device*)malloc(sizeof(struct sharcs_device));
+		device->device_id 				= sticks[n].device_id;
+		device->device_name 			= sticks[n].name;
+		device->device_description 		= "CULV3";
+		device->device_flags 			= 0;
+		device->device_warmup 			= 0;
+		device->device_features_size 	= 0;
+		device->device_features 		= (struct sharcs_feature**)malloc(sizeof(struct sharcs_feature*)*NUM_ACTORS);
+		
+		for(i=0;i<NUM_ACTORS;i++) {
+			a = &actors[i];
+			if(a->stick != n) {
+				continue;
+			}
+			
+			sticks[n].actors[sticks[n].actors_size++] = a;
+			
+			a->feature_id 	= SHARCS_ID_FEATURE_MAKE(mod->module_id,device->device_id,sticks[n].actors_size);
+			a->value 		= SHARCS_VALUE_UNKNOWN;
+			a->lastTime 	= 0;
+			a->pending 		= -1;
+			a->token 		= 0;
+			
+			feature = (struct sharcs_feature*)malloc(sizeof(struct sharcs_feature));
+			feature->feature_id 		= a->feature_id;
+			feature->feature_name 		= a->name;
+			
+			if(a->type == ACTOR_DIMMER) {
+				feature->feature_description 			= "dim light";
+				feature->feature_flags					= SHARCS_FLAG_SLIDER;
+				feature->feature_type 					= SHARCS_FEATURE_RANGE;
+				feature->feature_value.v_range.start 	= 0;
+				feature->feature_value.v_range.end	 	= FS20_DIM_MAX;
+				feature->feature_value.v_range.value	= SHARCS_VALUE_UNKNOWN;
+			} else {
+				feature->feature_description 			= "toggle light";
+				feature->feature_flags					= SHARCS_FLAG_POWER;
+				feature->feature_type 					= SHARCS_FEATURE_SWITCH;
+				feature->feature_value.v_switch.state 	= SHARCS_VALUE_UNKNOWN;
+			}
+			
+			device->device_features[device->device_features_size++] = feature;
 		}
-		feature->feature_description 			= "toggle light";
-		feature->feature_flags					= SHARCS_FLAG_POWER;
-		feature->feature_type 					= SHARCS_FEATURE_SWITCH;
-		feature->feature_value.v_switch.state 	= SHARCS_VALUE_UNKNOWN;
+		
+		mod->module_devices[n] = device;
 	}
 	
+	actor_index_build();
+	
 	/* fill module structure */
 	mod->module_name 			= "CUL";
 	mod->module_description 	= "control RF devices via CUL dongle";
 	mod->module_version 		= "1.0";
-	mod->module_devices_size 	= 1;
-	mod->module_devices 		= (struct sharcs_device**)malloc(sizeof(struct sharcs_device*)*1);
-	mod->module_devices[0]		= device;
 	mod->module_start 			= &module_start;
 	mod->module_stop 			= &module_stop;
 	mod->module_set_i			= &module_set_i;
 	mod->module_set_s 			= &module_set_s;
+	mod->module_set_batch		= &module_set_batch;
 	
 	module_id = mod->module_id;
 	
-	/* store callback function */
+	/* store callback functions */
 	sharcs_callback = cb;
+	sharcs_complete = complete;
 	
 	return 1;
 }
@@ -14,11 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <termios.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <signal.h>
 #include <sys/types.h>
 #include <string.h>
 #include <stdlib.h>
@@ -26,755 +23,1188 @@
 #include <sys/time.h>
 #include <ctype.h>
 #include <pthread.h>
-#include <sys/select.h>
-
-#include <ftdi.h>
 
+#include "../../tty.h"
 #include "av.h"
 
 /* 
 @TODO ! gracefully handle unknown values.. there might be more strange listening modes, or N/A return values, or other receiver models... 
 */
 
-int fd = -1,pipeFD[2];
-struct termios options;
+/*
+ * the receiver reports the new value of every command it executed, so
+ * replies are matched to the outstanding command of the same code.
+ * up to window commands (of distinct codes) are in flight at once,
+ * unanswered commands are resent after a timeout derived from the
+ * measured round trip time.
+ */
+#define AV_WINDOW 3
+#define AV_MAX_WINDOW 8
+#define AV_RETRIES 5
+#define AV_RTO_INITIAL 1000
+#define AV_RTO_MIN 200
+#define AV_RTO_MAX 5000
 
-/*------------------------------------------------------
- * buffers
- *------------------------------------------------------*/
-#define BUFFER_SIZE 128
-char readBuffer[BUFFER_SIZE], writeBuffer[BUFFER_SIZE],error[256];
-int readCounter, writeCounter;
-pthread_mutex_t mutex_write = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * unsent commands are queued per receiver. an absolute set replaces an
+ * unsent set of the same code, so e.g. a dragged volume slider only
+ * leaves its latest position in the queue.
+ */
+#define AV_QUEUE_SIZE 32
+
+/*
+ * state is polled per command to pick up changes made at the receiver
+ * whose report got lost. the interval of a command grows while polls
+ * confirm the known value or the receiver reports changes by itself,
+ * it shrinks when a poll reveals a missed change and drops to the
+ * minimum after the command has been set. polls only go out while no
+ * other commands are waiting and are limited to a budget of bytes/s.
+ */
+#define AV_POLL_MIN 2000
+#define AV_POLL_INITIAL 60000
+#define AV_POLL_MAX 600000
+/* query plus reply */
+#define AV_POLL_COST 18
+#define AV_POLL_BURST (AV_POLL_COST*AV_NUM_COMMANDS)
+
+/*
+ * eISCP wraps the ISCP messages in a header for network attached
+ * receivers: "ISCP", header size and data size (big endian 32 bit),
+ * version and three reserved bytes
+ */
+#define AV_EISCP_PORT 60128
+#define AV_EISCP_HEADER 16
+#define AV_EISCP_MAX 1024
+
+enum {
+	AV_QUEUE_QUERY		= 1<<0,
+	AV_QUEUE_ABSOLUTE	= 1<<1,
+};
+
+struct av_command {
+	int cmd, flags, retries;
+	long long sent;
+	char buf[64];
+	
+	// absolute sets, completed by the reply
+	int value;
+	unsigned int token;
+};
+
+struct av_context {
+	TTYCTX tty;
+	void (*callback)(AVCTX,int,int);
+	void (*complete)(AVCTX,unsigned int,int);
+	void *userdata;
+	
+	int state[AV_NUM_COMMANDS],pending[AV_NUM_COMMANDS];
+	int numPending;
+	
+	struct av_command inflight[AV_MAX_WINDOW];
+	int window, inflightCount;
+	int srtt, rttvar, rto;
+	
+	struct av_command queue[AV_QUEUE_SIZE];
+	int queueCount;
+	
+	// polling, credit in 1/1000 bytes
+	long long pollDue[AV_NUM_COMMANDS];
+	int pollInterval[AV_NUM_COMMANDS];
+	int pollBudget;
+	long long pollCredit, pollTime;
+	
+	int eiscp;
+	
+	char error[256];
+	pthread_mutex_t mutex_write;
+};
+
+/* errors of failed av_init_* calls, there is no context to hold them */
+char init_error[256];
 
 /*------------------------------------------------------
- * global variables and helper functions
+ * ISCP codec
+ *
+ * every command is described by one entry of av_commands,
+ * indexed by AV_CMD_*. adding a command means adding its
+ * AV_CMD_* constant and one table entry.
  *------------------------------------------------------*/
 
-enum {
-	AV_MODE_STOPPED,
-	AV_MODE_TTY,
-	AV_MODE_LIBFTDI,
+struct av_value {
+	int value;
+	const char *name;
 };
 
-#define MAP_CMD(i,cmd)\
-if(!strncmp(cmd,"PWR",3)) {\
-	i = AV_CMD_POWER;\
-} else if(!strncmp(cmd,"AMT",3)) {\
-	i = AV_CMD_MUTE;\
-} else if(!strncmp(cmd,"SLI",3)) {\
-	i = AV_CMD_INPUT;\
-} else if(!strncmp(cmd,"LMD",3)) {\
-	i = AV_CMD_MODE;\
-} else if(!strncmp(cmd,"MVL",3)) {\
-	i = AV_CMD_VOLUME;\
-} else if(!strncmp(cmd,"LTN",3)) {\
-	i = AV_CMD_LATENIGHT;\
-} else if(!strncmp(cmd,"DIM",3)) {\
-	i = AV_CMD_DIMMER;\
-} else if(!strncmp(cmd,"PRS",3)) {\
-	i = AV_CMD_PRESET;\
-}
-
-#define MAP_CMD2(i,cmd)\
-switch(i){\
-	case AV_CMD_POWER: cmd = "PWR"; break;\
-	case AV_CMD_MUTE: cmd = "AMT"; break;\
-	case AV_CMD_INPUT: cmd = "SLI"; break;\
-	case AV_CMD_MODE: cmd = "LMD"; break;\
-	case AV_CMD_VOLUME: cmd = "MVL"; break;\
-	case AV_CMD_LATENIGHT: cmd = "LTN"; break;\
-	case AV_CMD_DIMMER: cmd = "DIM"; break;\
-	case AV_CMD_PRESET: cmd = "PRS"; break;\
-	default: cmd = NULL; break;\
-}
-
-int state[AV_NUM_COMMANDS],pending[AV_NUM_COMMANDS];
-int numPending;
-void (*callback)(int,int);
-int (*av_main)() = NULL;
-int av_main_tty();
-int av_main_libftdi();
-int av_mode = AV_MODE_STOPPED;
-
-struct ftdi_context ftdic;
-
-void _sendCmd(const char *buf) {
-	int n;
-	
-	n = strlen(buf);
-	
-	pthread_mutex_lock( &mutex_write );
-	
-	if(writeCounter+n>BUFFER_SIZE) {
-		fprintf(stderr,"av: write buffer full, command skipped!\n");
-		pthread_mutex_unlock( &mutex_write );
-		return;
+/* first entry of a value is its canonical name, further entries are aliases */
+static const struct av_value av_inputs[] = {
+	{AV_INPUT_DVD,		"dvd"},
+	{AV_INPUT_VCR_DVR,	"vcr/dvr"},
+	{AV_INPUT_CBL_SAT,	"cbl/sat"},
+	{AV_INPUT_GAME_TV,	"game/tv"},
+	{AV_INPUT_AUX1,		"aux1"},
+	{AV_INPUT_AUX2,		"aux2"},
+	{AV_INPUT_TAPE,		"tape"},
+	{AV_INPUT_TUNER,	"tuner"},
+	{AV_INPUT_TUNER_AM,	"tuner(AM)"},
+	{AV_INPUT_CD,		"cd"},
+	{AV_INPUT_PHONO,	"phono"},
+	{AV_INPUT_VCR_DVR,	"vcr"},
+	{AV_INPUT_VCR_DVR,	"dvr"},
+	{AV_INPUT_CBL_SAT,	"cbl"},
+	{AV_INPUT_CBL_SAT,	"sat"},
+	{AV_INPUT_GAME_TV,	"game"},
+	{AV_INPUT_GAME_TV,	"tv"},
+	{AV_INPUT_GAME_TV,	"dock"},
+	{-1,NULL}
+};
+
+static const struct av_value av_modes[] = {
+	{AV_MODE_STEREO,		"stereo"},
+	{AV_MODE_DIRECT,		"direct"},
+	{AV_MODE_SURROUND,		"surround"},
+	{AV_MODE_ALL_CH_STEREO,	"allchstereo"},
+	{AV_MODE_FILM,			"film"},
+	{AV_MODE_THX,			"thx"},
+	{AV_MODE_ACTION,		"action"},
+	{AV_MODE_MUSICAL,		"musical"},
+	{AV_MODE_MONO_MOVIE,	"monomovie"},
+	{AV_MODE_ORCHESTRA,		"orchestra"},
+	{AV_MODE_UNPLUGGED,		"unplugged"},
+	{AV_MODE_STUDIO_MIX,	"studiomix"},
+	{AV_MODE_TV_LOGIC,		"tvlogic"},
+	{AV_MODE_THEATER,		"theater"},
+	{AV_MODE_ENHANCED7,		"enhanced7"},
+	{AV_MODE_MONO,			"mono"},
+	{AV_MODE_FULL_MONO,		"fullmono"},
+	{AV_MODE_PURE_AUDIO,	"pureaudio"},
+	{AV_MODE_PL_MOVIE,		"plmovie"},
+	{AV_MODE_PL_MUSIC,		"plmusic"},
+	{AV_MODE_NEO_CINEMA,	"neocinema"},
+	{AV_MODE_NEO_MUSIC,		"neomusic"},
+	{AV_MODE_NEO_THX_CINEMA,"neothxcinema"},
+	{AV_MODE_PL_THX_CINEMA,	"plthxcinema"},
+	{AV_MODE_PL_GAME,		"plgame"},
+	{AV_MODE_NEURAL_THX,	"neuralthx"},
+	{-1,NULL}
+};
+
+static const struct av_value av_dimmers[] = {
+	{AV_DIMMER_BRIGHTEST,	"brightest"},
+	{AV_DIMMER_BRIGHT,		"bright"},
+	{AV_DIMMER_DIM,			"dim"},
+	{AV_DIMMER_DARK,		"dark"},
+	{-1,NULL}
+};
+
+/* relative values passed through to the receiver */
+static const char *av_updown[] 	= {"up","down",NULL};
+static const char *av_up[] 		= {"up",NULL};
+static const char *av_dim[] 	= {"dim",NULL};
+
+struct av_command_def {
+	int cmd;
+	const char *code, *name;
+	int min, max;
+	/* volume counts down from 0x52 (82) */
+	int invert;
+	const struct av_value *values;
+	const char **relative;
+};
+
+static const struct av_command_def av_commands[] = {
+	{AV_CMD_POWER,		"PWR",	"power",		0,	1,	0,	NULL,			NULL},
+	{AV_CMD_MUTE,		"AMT",	"mute",			0,	1,	0,	NULL,			NULL},
+	{AV_CMD_INPUT,		"SLI",	"input",		0,	0,	0,	av_inputs,		av_updown},
+	{AV_CMD_MODE,		"LMD",	"mode",			0,	0,	0,	av_modes,		av_updown},
+	/* can go "up" to -20... but that would break the current implementation */
+	{AV_CMD_VOLUME,		"MVL",	"volume",		0,	60,	82,	NULL,			av_updown},
+	{AV_CMD_LATENIGHT,	"LTN",	"latenight",	0,	2,	0,	NULL,			av_up},
+	{AV_CMD_DIMMER,		"DIM",	"dimmer",		0,	0,	0,	av_dimmers,		av_dim},
+	{AV_CMD_PRESET,		"PRS",	"preset",		0,	30,	0,	NULL,			av_updown},
+};
+
+/*
+ * perfect hash over the three letter codes, the multiplier is searched
+ * once so that all codes of av_commands land in distinct slots
+ */
+#define AV_HASH_BITS 5
+#define AV_HASH_SIZE (1<<AV_HASH_BITS)
+
+static signed char av_hash_table[AV_HASH_SIZE];
+static unsigned int av_hash_mult;
+
+/* canonical names by value, built from the value tables */
+static const char *av_value_names[AV_NUM_COMMANDS][256];
+
+static pthread_once_t av_codec_once = PTHREAD_ONCE_INIT;
+
+static inline unsigned int av_hash(const char *code) {
+	unsigned int key = ((unsigned char)code[0]<<16)|((unsigned char)code[1]<<8)|(unsigned char)code[2];
+	
+	return (key*av_hash_mult)>>(32-AV_HASH_BITS);
+}
+
+static void av_codec_init() {
+	const struct av_value *v;
+	int i;
+	
+	for(av_hash_mult=2654435761u;;av_hash_mult+=2) {
+		memset(av_hash_table,-1,sizeof(av_hash_table));
+		for(i=0;i<AV_NUM_COMMANDS;i++) {
+			unsigned int h = av_hash(av_commands[i].code);
+			if(av_hash_table[h] >= 0) {
+				break;
+			}
+			av_hash_table[h] = i;
+		}
+		if(i == AV_NUM_COMMANDS) {
+			break;
+		}
+	}
+	
+	memset(av_value_names,0,sizeof(av_value_names));
+	for(i=0;i<AV_NUM_COMMANDS;i++) {
+		for(v=av_commands[i].values;v && v->name;v++) {
+			if(!av_value_names[i][v->value]) {
+				av_value_names[i][v->value] = v->name;
+			}
+		}
 	}
-	memcpy(writeBuffer+writeCounter,buf,n);
-	writeCounter+=n;
+}
+
+/*
+ * resolves a three letter ISCP code, returns -1 for unknown codes
+ */
+static inline int av_code2cmd(const char *code) {
+	int i;
 	
-	pthread_mutex_unlock( &mutex_write );
+	if(!code[0] || !code[1] || !code[2]) {
+		return -1;
+	}
 	
-	write(pipeFD[1], ".", 1);
+	i = av_hash_table[av_hash(code)];
+	if(i < 0 || memcmp(av_commands[i].code,code,3)) {
+		return -1;
+	}
+	return i;
 }
 
-int reqCmd(int i) {
-	char buf[64];
-	const char *cmd;
+static inline int av_hex(char c) {
+	if(c >= '0' && c <= '9') {
+		return c-'0';
+	} else if(c >= 'A' && c <= 'F') {
+		return c-'A'+10;
+	} else if(c >= 'a' && c <= 'f') {
+		return c-'a'+10;
+	}
+	return -1;
+}
+
+void av_timeout(TTYCTX tty);
+
+void av_complete(struct av_context *ctx,unsigned int token,int result) {
+	if(token && ctx->complete) {
+		ctx->complete(ctx,token,result);
+	}
+}
+int reqCmd(struct av_context *ctx,int i);
+
+long long av_now() {
+	struct timeval tv;
+	
+	gettimeofday(&tv,NULL);
+	
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+/*
+ * next command to poll, -1 if there is none. in standby the
+ * receiver only answers power queries.
+ */
+int av_poll_next(struct av_context *ctx) {
+	int i,next;
+	
+	if(ctx->pollBudget <= 0 || ctx->queueCount>0 || ctx->inflightCount>=ctx->window) {
+		return -1;
+	}
+	
+	for(next=-1,i=0;i<AV_NUM_COMMANDS;i++) {
+		if(ctx->pending[i] || (i != AV_CMD_POWER && ctx->state[AV_CMD_POWER] == 0)) {
+			continue;
+		}
+		if(next < 0 || ctx->pollDue[i] < ctx->pollDue[next]) {
+			next = i;
+		}
+	}
+	
+	return next;
+}
+
+void av_poll_refill(struct av_context *ctx,long long now) {
+	ctx->pollCredit += (now-ctx->pollTime)*ctx->pollBudget;
+	if(ctx->pollCredit > AV_POLL_BURST*1000) {
+		ctx->pollCredit = AV_POLL_BURST*1000;
+	}
+	ctx->pollTime = now;
+}
+
+/*
+ * moves the next poll of a command after a reply. old is the
+ * value before the reply, flags those of the answered command
+ * or -1 for a report the receiver sent by itself.
+ */
+void av_poll_update(struct av_context *ctx,int cmd,int old,int flags) {
+	int *interval = &ctx->pollInterval[cmd];
+	
+	if(flags < 0) {
+		*interval *= 2;
+	} else if(!(flags & AV_QUEUE_QUERY)) {
+		*interval = AV_POLL_MIN;
+	} else if(old >= 0 && old != ctx->state[cmd]) {
+		*interval /= 2;
+	} else {
+		*interval += *interval/2;
+	}
+	
+	if(*interval < AV_POLL_MIN) {
+		*interval = AV_POLL_MIN;
+	} else if(*interval > AV_POLL_MAX) {
+		*interval = AV_POLL_MAX;
+	}
+	
+	ctx->pollDue[cmd] = av_now()+*interval;
+}
+
+/*
+ * arms the tty timer for the earliest retransmission or poll
+ */
+void av_schedule(struct av_context *ctx) {
+	long long next = 0, due;
+	int i;
+	
+	for(i=0;i<ctx->window;i++) {
+		if(ctx->inflight[i].cmd >= 0 && (!next || ctx->inflight[i].sent+ctx->rto < next)) {
+			next = ctx->inflight[i].sent+ctx->rto;
+		}
+	}
+	
+	if((i = av_poll_next(ctx)) >= 0) {
+		due = ctx->pollDue[i];
+		
+		/* wait for enough credit */
+		av_poll_refill(ctx,av_now());
+		if(ctx->pollCredit < AV_POLL_COST*1000 && ctx->pollTime+(AV_POLL_COST*1000-ctx->pollCredit)/ctx->pollBudget > due) {
+			due = ctx->pollTime+(AV_POLL_COST*1000-ctx->pollCredit)/ctx->pollBudget;
+		}
+		
+		if(!next || due < next) {
+			next = due;
+		}
+	}
+	
+	if(!next) {
+		tty_set_timer(ctx->tty,-1,NULL);
+	} else {
+		next -= av_now();
+		tty_set_timer(ctx->tty,next>0?next:0,&av_timeout);
+	}
+}
+
+/*
+ * updates the retransmission timeout with a round trip sample (ms)
+ */
+void av_rtt(struct av_context *ctx,int r) {
+	if(ctx->srtt < 0) {
+		ctx->srtt = r;
+		ctx->rttvar = r/2;
+	} else {
+		ctx->rttvar = (3*ctx->rttvar + abs(ctx->srtt-r))/4;
+		ctx->srtt = (7*ctx->srtt + r)/8;
+	}
 	
-	MAP_CMD2(i,cmd);
-	if(!cmd) {
+	ctx->rto = ctx->srtt + 4*ctx->rttvar;
+	if(ctx->rto < AV_RTO_MIN) {
+		ctx->rto = AV_RTO_MIN;
+	} else if(ctx->rto > AV_RTO_MAX) {
+		ctx->rto = AV_RTO_MAX;
+	}
+}
+
+int av_prio(struct av_command *c);
+
+static inline unsigned int av_be32(const char *b) {
+	const unsigned char *u = (const unsigned char*)b;
+	return ((unsigned int)u[0]<<24)|(u[1]<<16)|(u[2]<<8)|u[3];
+}
+
+/*
+ * framer for eISCP packets, the payload is passed on without its
+ * terminator (EOF, CR, LF) just like a message read from the tty
+ */
+int av_eiscp_frame(TTYCTX tty,const char *buf,int len,int *start,int *length) {
+	const char *p;
+	unsigned int h,d;
+	
+	/* lost sync, skip to the next candidate header */
+	if(memcmp(buf,"ISCP",len<4?len:4)) {
+		p = (const char*)memchr(buf+1,'I',len-1);
+		*length = -1;
+		return p ? p-buf : len;
+	}
+	
+	if(len < AV_EISCP_HEADER) {
+		return 0;
+	}
+	
+	h = av_be32(buf+4);
+	d = av_be32(buf+8);
+	if(h < AV_EISCP_HEADER || d > AV_EISCP_MAX || h+d > AV_EISCP_MAX) {
+		*length = -1;
+		return 4;
+	}
+	if((unsigned int)len < h+d) {
 		return 0;
 	}
 	
-	if(pending[i]==0) {
+	for(p=buf+h+d;p>buf+h && (p[-1] == 0x1A || p[-1] == '\r' || p[-1] == '\n');p--);
+	
+	*start = h;
+	*length = p-(buf+h);
+	
+	return h+d;
+}
+
+/*
+ * hands a command to the tty layer, wrapped in an eISCP packet for
+ * network connections. ISCP messages end with CR there. returns 0
+ * if the command was refused, e.g. while the link is down.
+ */
+int av_send(struct av_context *ctx,struct av_command *c) {
+	char packet[AV_EISCP_HEADER+sizeof(c->buf)];
+	int len;
+	
+	if(!ctx->eiscp) {
+		return tty_send_prio(ctx->tty,c->buf,av_prio(c));
+	}
+	
+	len = strlen(c->buf);
+	if(len>0 && c->buf[len-1] == '\n') {
+		len--;
+	}
+	
+	memset(packet,0,AV_EISCP_HEADER);
+	memcpy(packet,"ISCP",4);
+	packet[7] = AV_EISCP_HEADER;
+	packet[10] = (len+1)>>8;
+	packet[11] = (len+1)&0xFF;
+	packet[12] = 0x01;
+	memcpy(packet+AV_EISCP_HEADER,c->buf,len);
+	packet[AV_EISCP_HEADER+len] = '\r';
+	
+	return tty_write(ctx->tty,packet,AV_EISCP_HEADER+len+1,av_prio(c));
+}
+
+/*
+ * power and mute go ahead of other sets, status queries come last
+ */
+int av_prio(struct av_command *c) {
+	if(c->flags & AV_QUEUE_QUERY) {
+		return TTY_PRIO_LOW;
+	} else if(c->cmd == AV_CMD_POWER || c->cmd == AV_CMD_MUTE) {
+		return TTY_PRIO_HIGH;
+	}
+	return TTY_PRIO_NORMAL;
+}
+
+/*
+ * hands queued commands to the tty layer while the window has room.
+ * a command waits while another one of the same code is in flight,
+ * commands of other codes may pass it.
+ */
+void av_flush(struct av_context *ctx) {
+	unsigned int failed[AV_QUEUE_SIZE];
+	int i,n,q,slot;
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	
+	for(n=0,q=0;q<ctx->queueCount && ctx->inflightCount<ctx->window;) {
+		struct av_command *c = &ctx->queue[q];
+		
+		for(slot=-1,i=0;i<ctx->window;i++) {
+			if(c->cmd >= 0 && ctx->inflight[i].cmd == c->cmd) {
+				break;
+			}
+			if(slot < 0 && ctx->inflight[i].cmd < 0) {
+				slot = i;
+			}
+		}
+		
+		/* same code already in flight => keep it queued */
+		if(i<ctx->window) {
+			q++;
+			continue;
+		}
+		
+		/* the link is down, nothing will be confirmed */
+		if(!av_send(ctx,c)) {
+			if((c->flags & AV_QUEUE_QUERY) && ctx->pending[c->cmd]>0) {
+				ctx->pending[c->cmd]=0;
+				ctx->numPending--;
+			}
+			failed[n++] = c->token;
+		/* replies can not be matched without a command code */
+		} else if(c->cmd >= 0) {
+			ctx->inflight[slot] = *c;
+			ctx->inflight[slot].retries = 0;
+			ctx->inflight[slot].sent = av_now();
+			ctx->inflightCount++;
+		}
+		
+		memmove(ctx->queue+q,ctx->queue+q+1,sizeof(struct av_command)*(ctx->queueCount-q-1));
+		ctx->queueCount--;
+	}
+	
+	av_schedule(ctx);
+	
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	while(n>0) {
+		av_complete(ctx,failed[--n],AV_DONE_FAILED);
+	}
+}
+
+/*
+ * resends unanswered commands, e.g. when receiver is in standby
+ * some requests get "lost". commands are dropped after AV_RETRIES.
+ */
+void av_timeout(TTYCTX tty) {
+	struct av_context *ctx = (struct av_context*)tty_userdata(tty);
+	struct av_command *c;
+	unsigned int failed[AV_MAX_WINDOW];
+	long long now;
+	int i,n,resent;
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	
+	now = av_now();
+	for(resent=0,n=0,i=0;i<ctx->window;i++) {
+		c = &ctx->inflight[i];
+		if(c->cmd < 0 || c->sent+ctx->rto > now) {
+			continue;
+		}
+		
+		if(c->retries >= AV_RETRIES) {
+			if(ctx->pending[c->cmd]>0) {
+				ctx->pending[c->cmd]=0;
+				ctx->numPending--;
+			}
+			/* poll unanswered commands less often */
+			av_poll_update(ctx,c->cmd,-1,-1);
+			failed[n++] = c->token;
+			c->cmd = -1;
+			ctx->inflightCount--;
+			continue;
+		}
 		
-		sprintf(buf,"!1%sQSTN\n",cmd);
-		_sendCmd(buf);
+		c->retries++;
+		c->sent = now;
+		av_send(ctx,c);
+		resent = 1;
+	}
+	
+	/* back off while the receiver does not answer, once per expiry */
+	if(resent) {
+		ctx->rto = ctx->rto*2 > AV_RTO_MAX ? AV_RTO_MAX : ctx->rto*2;
+	}
+	
+	/* poll the most overdue command if the budget allows */
+	i = av_poll_next(ctx);
+	if(i >= 0 && ctx->pollDue[i] <= now) {
+		av_poll_refill(ctx,now);
+		if(ctx->pollCredit >= AV_POLL_COST*1000) {
+			ctx->pollCredit -= AV_POLL_COST*1000;
+		} else {
+			i = -1;
+		}
+	} else {
+		i = -1;
+	}
+	
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	while(n>0) {
+		av_complete(ctx,failed[--n],AV_DONE_FAILED);
+	}
+	
+	if(i >= 0) {
+		reqCmd(ctx,i);
+	} else {
+		av_flush(ctx);
+	}
+}
+
+/*
+ * queues a command, value and token are those of absolute sets (-1 and
+ * 0 otherwise). returns 0 if the queue is full
+ */
+int _sendCmd(struct av_context *ctx,int cmd,int flags,const char *buf,int value,unsigned int token) {
+	struct av_command *c;
+	unsigned int superseded;
+	int q;
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	
+	c = NULL;
+	superseded = 0;
+	
+	/* a newer absolute value supersedes the last unsent one of that code */
+	if(flags & AV_QUEUE_ABSOLUTE) {
+		for(q=ctx->queueCount-1;q>=0;q--) {
+			if(ctx->queue[q].cmd == cmd) {
+				if(ctx->queue[q].flags & AV_QUEUE_ABSOLUTE) {
+					c = &ctx->queue[q];
+					superseded = c->token;
+				}
+				break;
+			}
+		}
+	}
+	
+	if(!c) {
+		if(ctx->queueCount>=AV_QUEUE_SIZE) {
+			fprintf(stderr,"av: command queue full, command skipped!\n");
+			pthread_mutex_unlock( &ctx->mutex_write );
+			return 0;
+		}
+		c = &ctx->queue[ctx->queueCount++];
+	}
+	
+	c->cmd = cmd;
+	c->flags = flags;
+	strncpy(c->buf,buf,sizeof(c->buf)-1);
+	c->buf[sizeof(c->buf)-1] = 0x0;
+	c->value = value;
+	c->token = token;
+	
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	av_complete(ctx,superseded,AV_DONE_SUPERSEDED);
+	
+	av_flush(ctx);
+	
+	return 1;
+}
 
-		pending[i] = time(NULL);
-		numPending++;
+int reqCmd(struct av_context *ctx,int i) {
+	char buf[64];
+	int query;
+	
+	if(i < 0 || i >= AV_NUM_COMMANDS) {
+		return 0;
+	}
+	
+	/* one query per command, the answer is received by the reactor */
+	pthread_mutex_lock( &ctx->mutex_write );
+	query = ctx->pending[i]==0;
+	if(query) {
+		ctx->pending[i] = time(NULL);
+		ctx->numPending++;
+	}
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	if(!query) {
+		return 1;
+	}
+	
+	sprintf(buf,"!1%sQSTN\n",av_commands[i].code);
+	if(!_sendCmd(ctx,i,AV_QUEUE_QUERY,buf,-1,0)) {
+		pthread_mutex_lock( &ctx->mutex_write );
+		if(ctx->pending[i]>0) {
+			ctx->pending[i]=0;
+			ctx->numPending--;
+		}
+		pthread_mutex_unlock( &ctx->mutex_write );
 	}
 	
 	return 1;
 }
 
-int sendCmds(int i, const char *v) {
+int sendCmds(struct av_context *ctx,int i, const char *v) {
 	char buf[64];
-	const char *cmd;
 	int j,len;
 	
-	MAP_CMD2(i,cmd);
-	if(!cmd) {
+	if(i < 0 || i >= AV_NUM_COMMANDS) {
 		return 0;
 	}
 	
-	sprintf(buf,"!1%s%s\n",cmd,v);
+	sprintf(buf,"!1%s%s\n",av_commands[i].code,v);
 	
 	/* convert value to upper case */
 	for(len=strlen(v),j=5;j<5+len;j++) {
 		buf[j] = toupper(buf[j]);
 	}
 	
-	_sendCmd(buf);
-	
-	return 1;
+	/* up/down are relative, each one has to reach the receiver */
+	return _sendCmd(ctx,i,0,buf,-1,0);
 }
 
-int sendCmdi(int i, int v) {
+int sendCmdi(struct av_context *ctx,int i, int v,unsigned int token) {
 	char buf[64];
-	const char *cmd;
+	int raw,state;
 	
-	MAP_CMD2(i,cmd);
-	if(!cmd || state[i] == v) {
+	if(i < 0 || i >= AV_NUM_COMMANDS) {
 		return 0;
 	}
 	
+	pthread_mutex_lock( &ctx->mutex_write );
+	state = ctx->state[i];
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	/* nothing to send, a set with a token is complete right away */
+	if(state == v) {
+		if(!token) {
+			return 0;
+		}
+		av_complete(ctx,token,AV_DONE_OK);
+		return 1;
+	}
+	
 	/* value conversion */
-	if(i == AV_CMD_VOLUME) {
-		v = (80-v+2);
+	raw = v;
+	if(av_commands[i].invert) {
+		raw = av_commands[i].invert-v;
 	}
 	
-	sprintf(buf,"!1%s%02X\n",cmd,v);
-	_sendCmd(buf);
+	sprintf(buf,"!1%s%02X\n",av_commands[i].code,raw);
 	
-	return 1;
+	return _sendCmd(ctx,i,AV_QUEUE_ABSOLUTE,buf,v,token);
 }
 
-int recvCmd(const char *buf) {
-	char cmd[3];
-	int v = 0, i = -1;
+/* parses a message, returns the command and stores its value or -1 */
+int recvCmd(struct av_context *ctx,const char *buf,int len,int *value) {
+	int v,h,l,i;
 	
-	sscanf(buf,"!1%3s%2x",cmd,&v);
+	/* "!1" + code + two hex digits */
+	if(len < 7 || buf[0] != '!' || buf[1] != '1' || (i = av_code2cmd(buf+2)) < 0) {
+		return -1;
+	}
 	
-	MAP_CMD(i,cmd);
-	if(i<0) {
+	if((h = av_hex(buf[5])) < 0 || (l = av_hex(buf[6])) < 0) {
+		printf("av: received unknown value for '%s' (bytes: '%s')\n",av_commands[i].name,buf);
 		return -1;
 	}
+	v = (h<<4)|l;
 	
 	/* value conversion */
-	if(i == AV_CMD_VOLUME) {
-		v = (80-v+2);
+	if(av_commands[i].invert) {
+		v = av_commands[i].invert-v;
 	}
 	
 	if(!av_validvi(i,v)) {
-		printf("av: received unknown value 0x%2x for '%s' (bytes: '%s')\n",v,av_cmd2str(i),buf);
-		return 0;
+		printf("av: received unknown value 0x%2x for '%s' (bytes: '%s')\n",v,av_commands[i].name,buf);
+		return -1;
 	}
 	
-	state[i] = v;
+	*value = v;
+	
+	return i;
+}
+
+/*
+ * called by the tty reactor for every message
+ */
+void av_recv(TTYCTX tty,const char *buf,int len) {
+	struct av_context *ctx = (struct av_context*)tty_userdata(tty);
+	unsigned int token;
+	int i,j,v,old,flags,result;
+	
+	i = recvCmd(ctx,buf,len,&v);
 	
-	if(callback) {
-		callback(i,v);
+	pthread_mutex_lock( &ctx->mutex_write );
+	if(i >= 0) {
+		old = ctx->state[i];
+		ctx->state[i] = v;
+		
+		if(ctx->pending[i]>0) {
+			ctx->pending[i]=0;
+			ctx->numPending--;
+		}
 	}
+	for(token=0,flags=-1,j=0;i>=0 && j<ctx->window;j++) {
+		if(ctx->inflight[j].cmd == i) {
+			/* only unambiguous samples (karn) */
+			if(ctx->inflight[j].retries == 0) {
+				av_rtt(ctx,av_now()-ctx->inflight[j].sent);
+			}
+			flags = ctx->inflight[j].flags;
+			token = ctx->inflight[j].token;
+			/* the receiver answers with the value it actually took */
+			result = ctx->state[i] == ctx->inflight[j].value ? AV_DONE_OK : AV_DONE_FAILED;
+			ctx->inflight[j].cmd = -1;
+			ctx->inflightCount--;
+			break;
+		}
+	}
+	if(i >= 0) {
+		av_poll_update(ctx,i,old,flags);
+	}
+	pthread_mutex_unlock( &ctx->mutex_write );
 	
-	if(pending[i]>0) {
-		pending[i]=0;
-		numPending--;
+	if(i >= 0 && ctx->callback) {
+		ctx->callback(ctx,i,v);
 	}
 	
-	return i;
+	if(token) {
+		av_complete(ctx,token,result);
+	}
+	
+	av_flush(ctx);
+}
+
+/*
+ * fails all unconfirmed commands, e.g. when the link is gone
+ */
+void av_drop(struct av_context *ctx) {
+	unsigned int failed[AV_MAX_WINDOW+AV_QUEUE_SIZE];
+	int i,n;
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	for(n=0,i=0;i<ctx->window;i++) {
+		if(ctx->inflight[i].cmd >= 0) {
+			failed[n++] = ctx->inflight[i].token;
+			ctx->inflight[i].cmd = -1;
+		}
+	}
+	ctx->inflightCount = 0;
+	while(ctx->queueCount>0) {
+		failed[n++] = ctx->queue[--ctx->queueCount].token;
+	}
+	/* unanswered queries are asked again once the link is back */
+	memset(ctx->pending,0,sizeof(int)*AV_NUM_COMMANDS);
+	ctx->numPending = 0;
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	while(n>0) {
+		av_complete(ctx,failed[--n],AV_DONE_FAILED);
+	}
+}
+
+/*
+ * called by the tty reactor when the link goes down or comes back
+ */
+void av_link(TTYCTX tty,int state) {
+	struct av_context *ctx = (struct av_context*)tty_userdata(tty);
+	
+	if(state != TTY_CONNECTED) {
+		av_drop(ctx);
+		return;
+	}
+	
+	/* the receiver may have changed meanwhile */
+	av_req(ctx,AV_CMD_ALL);
 }
 
 /*------------------------------------------------------------*/
 
-const char* av_error() {
-	if(error[0]==0) {
-		return NULL;
+const char* av_error(struct av_context *ctx) {
+	if(!ctx) {
+		return init_error[0] ? init_error : NULL;
+	}
+	if(ctx->error[0]==0) {
+		return ctx->tty ? tty_error(ctx->tty) : NULL;
 	}
-	return error;
+	return ctx->error;
 }
 
+void *av_userdata(struct av_context *ctx) {
+	return ctx->userdata;
+}
 
-int av_init_internal(void (*cb)(int,int)) {
-	callback = cb;
+struct av_context *av_init_internal(void (*cb)(AVCTX,int,int),void *userdata) {
+	struct av_context *ctx;
+	int i;
 	
-	memset(state,-1,sizeof(int)*AV_NUM_COMMANDS);
-	memset(pending,0,sizeof(int)*AV_NUM_COMMANDS);
+	pthread_once(&av_codec_once,&av_codec_init);
 	
-	pipe(pipeFD);
+	ctx = (struct av_context*)malloc(sizeof(struct av_context));
 	
-	readCounter = 0;
-	writeCounter = 0;
-	numPending = 0;
+	ctx->tty = NULL;
+	ctx->callback = cb;
+	ctx->complete = NULL;
+	ctx->userdata = userdata;
+	ctx->error[0] = 0;
 	
-	return 1;
+	memset(ctx->state,-1,sizeof(int)*AV_NUM_COMMANDS);
+	memset(ctx->pending,0,sizeof(int)*AV_NUM_COMMANDS);
+	
+	ctx->queueCount = 0;
+	ctx->numPending = 0;
+	ctx->window = AV_WINDOW;
+	ctx->inflightCount = 0;
+	ctx->srtt = -1;
+	ctx->rttvar = 0;
+	ctx->rto = AV_RTO_INITIAL;
+	
+	for(i=0;i<AV_MAX_WINDOW;i++) {
+		ctx->inflight[i].cmd = -1;
+	}
+	
+	ctx->eiscp = 0;
+	ctx->pollBudget = 0;
+	ctx->pollCredit = 0;
+	ctx->pollTime = av_now();
+	for(i=0;i<AV_NUM_COMMANDS;i++) {
+		ctx->pollInterval[i] = AV_POLL_INITIAL;
+		ctx->pollDue[i] = ctx->pollTime+AV_POLL_INITIAL;
+	}
+	
+	pthread_mutex_init(&ctx->mutex_write, NULL);
+	
+	return ctx;
 }
 
-int av_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(int,int)) {
-	int ret;
+void av_free(struct av_context *ctx) {
+	tty_close(ctx->tty);
+	pthread_mutex_destroy(&ctx->mutex_write);
+	free(ctx);
+}
+
+struct av_context *av_start(struct av_context *ctx) {
+	if(ctx->eiscp) {
+		tty_set_framer(ctx->tty,&av_eiscp_frame);
+		tty_set_max_frame(ctx->tty,AV_EISCP_MAX);
+	/* messages are terminated by EOF (0x1A) */
+	} else {
+		tty_set_event_char(ctx->tty,0x1A);
+	}
+	tty_set_state_callback(ctx->tty,&av_link);
 	
-	if (ftdi_init(&ftdic) < 0) {
-        sprintf(error, "ftdi_init failed\n");
-        return 0;
-    }
+	if(!tty_start(ctx->tty)) {
+		sprintf(init_error,"%s",tty_error(ctx->tty));
+		av_free(ctx);
+		return NULL;
+	}
 	
-	if ((ret = ftdi_usb_open_desc_index(&ftdic, vendor,product,description,serial,index)) < 0) {
-        sprintf(error, "unable to open ftdi device: %d (%s)\n", ret, ftdi_get_error_string(&ftdic));
-        return 0;
-    }
-
-	ftdi_usb_purge_rx_buffer(&ftdic);
-	ftdi_set_latency_timer(&ftdic,40);
-	ftdi_set_event_char(&ftdic,0x1A,1);
+	return ctx;
+}
 
-	// set av_main implementation
-	av_mode = AV_MODE_LIBFTDI;
-	av_main = &av_main_libftdi;
+struct av_context *av_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(AVCTX,int,int),void *userdata) {
+	struct av_context *ctx;
 	
-	// initialize variables
-	av_init_internal(cb);
+	ctx = av_init_internal(cb,userdata);
 	
+	if(!(ctx->tty = tty_init_libftdi(vendor,product,description,serial,index,&av_recv,ctx))) {
+		sprintf(init_error, "unable to open ftdi device");
+		av_free(ctx);
+		return NULL;
+	}
 	
-	return 1;
+	return av_start(ctx);
 }
 
-int av_init_tty(const char *devicename,void (*cb)(int,int)) {
-	fd = open(devicename,O_RDWR | O_NOCTTY | O_NDELAY);
-	if (fd < 0) {
-		sprintf(error,"%s - %s",devicename,strerror(errno));
-		return 0;
-	}
+struct av_context *av_init_tty(const char *devicename,void (*cb)(AVCTX,int,int),void *userdata) {
+	struct av_context *ctx;
 	
-	tcgetattr(fd, &options);
-	cfsetispeed(&options, B9600);
+	ctx = av_init_internal(cb,userdata);
 	
-	options.c_cflag |= (CLOCAL | CREAD);
-	options.c_cflag &= ~PARENB;
-	options.c_cflag &= ~CSTOPB;
-	options.c_cflag &= ~CSIZE;
-	options.c_cflag |= CS8;
+	if(!(ctx->tty = tty_init(devicename,&av_recv,ctx))) {
+		sprintf(init_error,"unable to open %s",devicename);
+		av_free(ctx);
+		return NULL;
+	}
 	
-	tcsetattr(fd, TCSANOW, &options);
-	tcflush(fd,TCIOFLUSH);
+	return av_start(ctx);
+}
+
+struct av_context *av_init_eiscp(const char *host,int port,void (*cb)(AVCTX,int,int),void *userdata) {
+	struct av_context *ctx;
 	
-	// set av_main implementation
-	av_mode = AV_MODE_TTY;
-	av_main = &av_main_tty;
+	ctx = av_init_internal(cb,userdata);
 	
-	// initialize variables
-	av_init_internal(cb);
+	if(port <= 0) {
+		port = AV_EISCP_PORT;
+	}
 	
-	return 1;
+	if(!(ctx->tty = tty_init_tcp(host,port,&av_recv,ctx))) {
+		sprintf(init_error,"unable to connect to %s:%d",host,port);
+		av_free(ctx);
+		return NULL;
+	}
+	ctx->eiscp = 1;
+	
+	return av_start(ctx);
 }
 
-void av_req(int cmd) {
+void av_req(struct av_context *ctx,int cmd) {
 	if(cmd < 0 || cmd >= AV_NUM_COMMANDS) {
 		int i;
 		for(i=0;i<AV_NUM_COMMANDS;i++) {
-			reqCmd(i);
+			reqCmd(ctx,i);
 		}
 	} else {
-		reqCmd(cmd);
+		reqCmd(ctx,cmd);
 	}
 }
 
-int av_seti(int cmd, int v) {
+int av_seti(struct av_context *ctx,int cmd, int v) {
+	if(!av_validvi(cmd,v)) {
+		sprintf(ctx->error,"invalid value '%d' for '%s'",v,av_cmd2str(cmd));
+		return 0;
+	}
+	
+	return sendCmdi(ctx,cmd,v,0);
+}
+
+int av_seti_token(struct av_context *ctx,int cmd,int v,unsigned int token) {
 	if(!av_validvi(cmd,v)) {
-		sprintf(error,"invalid value '%d' for '%s'",v,av_cmd2str(cmd));
+		sprintf(ctx->error,"invalid value '%d' for '%s'",v,av_cmd2str(cmd));
 		return 0;
 	}
 	
-	return sendCmdi(cmd,v);
+	return sendCmdi(ctx,cmd,v,token);
 }
 
-int av_sets(int cmd, const char* v) {
+void av_set_complete(struct av_context *ctx,void (*cb)(AVCTX,unsigned int,int)) {
+	ctx->complete = cb;
+}
+
+int av_sets(struct av_context *ctx,int cmd, const char* v) {
 	int iv;
 	
 	if(!av_validvs(cmd,v)) {
-		sprintf(error,"invalid value '%s' for '%s'",v,av_cmd2str(cmd));
+		sprintf(ctx->error,"invalid value '%s' for '%s'",v,av_cmd2str(cmd));
 		return 0;
 	}
 	
 	iv = av_str2v(cmd,v);
 	if(iv>=0) {
-		return sendCmdi(cmd,iv);
+		return sendCmdi(ctx,cmd,iv,0);
 	}
-	return sendCmds(cmd,v);
+	return sendCmds(ctx,cmd,v);
 }
 
-int av_state(int cmd) {
+int av_state(struct av_context *ctx,int cmd) {
+	int state;
+	
 	if(cmd < 0 || cmd >= AV_NUM_COMMANDS) {
 		return -1;
 	}
-	return state[cmd];
-}
-
-int av_busy() {
-	return writeCounter>0||readCounter>0||numPending>0;
-}
-
-int av_stop() {
-	if(av_mode == AV_MODE_STOPPED) {
-		return 0;
-	}
-	
-	if(av_mode == AV_MODE_TTY && fd>=0) {
-		tcsetattr(fd,TCSANOW,&options);
-		close(fd);
-		fd = -1;
-	} else if(av_mode == AV_MODE_LIBFTDI) {
-		int ret = 0;
-		if ((ret = ftdi_usb_close(&ftdic)) < 0) {
-			sprintf(error, "unable to close ftdi device: %d (%s)\n", ret, ftdi_get_error_string(&ftdic));
-			return 0;
-		}
-
-		ftdi_deinit(&ftdic);
-	}
-	
-	close(pipeFD[0]);
-	close(pipeFD[1]);
 	
-	av_mode = AV_MODE_STOPPED;
+	pthread_mutex_lock( &ctx->mutex_write );
+	state = ctx->state[cmd];
+	pthread_mutex_unlock( &ctx->mutex_write );
 	
-	return 1;
+	return state;
 }
 
-int av_main_libftdi() {
-	static int answer_pending = -1,answer_length;
-	static time_t answer_timer;
-	static char answer_buffer[64];
+int av_set_window(struct av_context *ctx,int window) {
+	unsigned int failed[AV_MAX_WINDOW];
+	int i,n;
 	
-	int ret,i,s,c;
-	char buf[64];
-	
-	if(av_mode != AV_MODE_LIBFTDI) {
+	if(window < 1 || window > AV_MAX_WINDOW) {
+		sprintf(ctx->error,"invalid window size %d",window);
 		return 0;
 	}
 	
-	/* read data */
-	ret = ftdi_read_data(&ftdic,(unsigned char*)(readBuffer+readCounter),BUFFER_SIZE-readCounter);
-	if(ret > 0) {
-		readCounter += ret;
-
-		/* check for complete messages */
-		for(s=0,i=0;i<readCounter;i++) {
-			if(readBuffer[i] == 0x1A) {
-				memcpy(buf,readBuffer+s,i-s);
-				buf[i-s] = 0x0;
-				if(answer_pending==recvCmd(buf)) {
-					answer_pending = -1;
-				}
-				s = i+1;
-			}
-		}
-		
-		if(s>=readCounter) {
-			readCounter = 0;
-		} else if(s>0) {
-			memmove(readBuffer,readBuffer+s,readCounter-s);
-			readCounter-=s;
-		}
-		return 1;
-	} else if(ret < 0) {
-		sprintf(error,"read() failed");
-		av_stop();
-		
-		return 0;
-	}
+	pthread_mutex_lock( &ctx->mutex_write );
 	
-	/* write data */
-	if(writeCounter>0 && answer_pending<0) {
-		// find length of first command
-		for(c=0;c<writeCounter;c++) {
-			if(writeBuffer[c] == '\n') {
-				c++;
-				break;
+	/* forget commands in slots beyond a shrunk window, late replies count as reports */
+	for(n=0,i=window;i<ctx->window;i++) {
+		if(ctx->inflight[i].cmd >= 0) {
+			if(ctx->pending[ctx->inflight[i].cmd]>0) {
+				ctx->pending[ctx->inflight[i].cmd]=0;
+				ctx->numPending--;
 			}
+			failed[n++] = ctx->inflight[i].token;
+			ctx->inflight[i].cmd = -1;
+			ctx->inflightCount--;
 		}
-		
-		pthread_mutex_lock( &mutex_write );
-		
-		if(!strncmp(writeBuffer+5,"QSTN",4)) {
-			MAP_CMD(answer_pending,writeBuffer+2);
-			answer_timer = time(NULL);
-			memcpy(answer_buffer,writeBuffer,c);
-			answer_length = c;
-		}
-		
-		ret = ftdi_write_data(&ftdic,(unsigned char*)writeBuffer,c);
-		if(ret<0) {
-			sprintf(error,"write() failed");
-			av_stop();
-			return 0;
-		} else if(ret==writeCounter) {
-			writeCounter=0;
-		} else if(ret>0){
-			memmove(writeBuffer,writeBuffer+ret,writeCounter-ret);
-			writeCounter-=ret;
-		}
+	}
+	ctx->window = window;
 	
-		pthread_mutex_unlock( &mutex_write );
-		return 1;
-	} 
+	pthread_mutex_unlock( &ctx->mutex_write );
 	
-	if(answer_pending>=0 && time(NULL)-answer_timer>=5) {
-		ftdi_write_data(&ftdic,(unsigned char*)answer_buffer,answer_length);
-		answer_timer = time(NULL);
-		return 1;
+	while(n>0) {
+		av_complete(ctx,failed[--n],AV_DONE_FAILED);
 	}
 	
+	av_flush(ctx);
+	
 	return 1;
 }
 
-int av_main_tty() {
-	int res,i,s;
-	char buf[64];
-	struct timeval tv;
-	
-	fd_set readFDs, writeFDs, exceptFDs;
-	
-	if(av_mode != AV_MODE_TTY) {
+int av_set_polling(struct av_context *ctx,int budget) {
+	if(budget < 0) {
+		sprintf(ctx->error,"invalid polling budget %d",budget);
 		return 0;
 	}
 	
-	tv.tv_sec 	= 30;
-	tv.tv_usec 	= 0;
+	pthread_mutex_lock( &ctx->mutex_write );
+	av_poll_refill(ctx,av_now());
+	ctx->pollBudget = budget;
+	av_schedule(ctx);
+	pthread_mutex_unlock( &ctx->mutex_write );
 	
-	if(fd<=0) {
-		sprintf(error,"not connected");
-		return 0;
-	}
-	
-	FD_ZERO(&readFDs);
-	FD_ZERO(&writeFDs);
-	FD_ZERO(&exceptFDs);
+	return 1;
+}
 
-	if(writeCounter>0) {
-		FD_SET(fd, &writeFDs);
-	}
-	FD_SET(fd, &readFDs);
-	FD_SET(fd, &exceptFDs);
-	FD_SET(pipeFD[0],&readFDs);
-	
-	res = select((fd>pipeFD[0]?fd:pipeFD[0])+1, &readFDs, &writeFDs, &exceptFDs, &tv);
-		
-	if(FD_ISSET(pipeFD[0],&readFDs)) {
-		char tmpBuffer[32];
-		read(pipeFD[0], tmpBuffer, 32);
-	}
-		
-	/* socket ready to read */
-	if(FD_ISSET(fd,&readFDs)) {
-		res = read(fd,readBuffer+readCounter,BUFFER_SIZE-readCounter);
-		/* received some bytes */
-		if(res>0) {
-			readCounter += res;
-
-			/* check for complete messages */
-			for(s=0,i=0;i<readCounter;i++) {
-				if(readBuffer[i] == 0x1A) {
-					memcpy(buf,readBuffer+s,i-s);
-					buf[i-s] = 0x0;
-					recvCmd(buf);
-					s = i+1;
-				}
-			}
-			
-			if(s>=readCounter) {
-				readCounter = 0;
-			} else if(s>0) {
-				memmove(readBuffer,readBuffer+s,readCounter-s);
-				readCounter-=s;
-			}
-		/* error */
-		} else if(res<0) {
-			sprintf(error,"read() failed");
-			av_stop();
-			return 0;
-		}
-		
-		if(readCounter == BUFFER_SIZE) {
-			sprintf(error,"read buffer overflow detected\n");
-			av_stop();
-			return 0;
-		}
-	}
-	
-	/* socket ready to write */
-	if(FD_ISSET(fd,&writeFDs)) {
-		pthread_mutex_lock( &mutex_write );
-		
-		res = write(fd,writeBuffer,writeCounter);
-		if(res<0) {
-			sprintf(error,"write() failed");
-			av_stop();
-			return 0;
-		} else if(res==writeCounter) {
-			writeCounter=0;
-		} else if(res>0){
-			memmove(writeBuffer,writeBuffer+res,writeCounter-res);
-			writeCounter-=res;
-		}
-		
-		pthread_mutex_unlock( &mutex_write );
-	}
+int av_busy(struct av_context *ctx) {
+	return ctx->queueCount>0||ctx->inflightCount>0||ctx->numPending>0||tty_busy(ctx->tty);
+}
+
+int av_stop(struct av_context *ctx) {
+	tty_close(ctx->tty);
+	ctx->tty = NULL;
 	
-	/* socket error */
-	if(FD_ISSET(fd,&exceptFDs)) {
-		sprintf(error,"device error");
-		av_stop();
-		return 0;
-	}		
-	
-	/* when receiver is in standby, some requests get "lost" => try to resend */
-	if(res<=0&&numPending>0) {
-		time_t now = time(NULL);
-		for(i=0;i<AV_NUM_COMMANDS;i++) {
-			if(pending[i]>0 && now-pending[i]>=5) {
-				pending[i] = 0;
-				numPending--;
-				av_req(i);
-				break;
-			}
-		}
-	}
+	/* the reactor is gone, nothing will be confirmed anymore */
+	av_drop(ctx);
+	av_free(ctx);
 	
 	return 1;
 }
 
 const char* av_cmd2str(int cmd) {
-	switch(cmd){
-		case AV_CMD_POWER: return "power";
-		case AV_CMD_MUTE: return "mute";
-		case AV_CMD_INPUT: return "input";
-		case AV_CMD_MODE: return "mode";
-		case AV_CMD_VOLUME: return "volume";
-		case AV_CMD_LATENIGHT: return "latenight";
-		case AV_CMD_DIMMER: return "dimmer";
-		case AV_CMD_PRESET: return "preset";
+	if(cmd < 0 || cmd >= AV_NUM_COMMANDS) {
+		return NULL;
 	}
-	return NULL;
+	return av_commands[cmd].name;
 }
 
 int av_str2cmd(const char* cmd) {
-	if(!strcmp(cmd,"power")) {
-		return AV_CMD_POWER;
-	} else if(!strcmp(cmd,"mute")) {
-		return AV_CMD_MUTE;
-	} else if(!strcmp(cmd,"input")) {
-		return AV_CMD_INPUT;
-	} else if(!strcmp(cmd,"mode")) {
-		return AV_CMD_MODE;
-	} else if(!strcmp(cmd,"volume")) {
-		return AV_CMD_VOLUME;
-	} else if(!strcmp(cmd,"latenight")) {
-		return AV_CMD_LATENIGHT;
-	} else if(!strcmp(cmd,"dimmer")) {
-		return AV_CMD_DIMMER;
-	} else if(!strcmp(cmd,"preset")) {
-		return AV_CMD_PRESET;
+	int i;
+	
+	for(i=0;i<AV_NUM_COMMANDS;i++) {
+		if(!strcmp(cmd,av_commands[i].name)) {
+			return i;
+		}
 	}
 	return -1;
 }
 
 const char* av_v2str(int cmd,int v) {
-	static const char *res;
 	static char buffer[256];
 	
-	res = NULL;
-	
-	switch(cmd) {
-		case AV_CMD_INPUT:
-			switch(v) {
-				case AV_INPUT_DVD: res = "dvd"; break;
-				case AV_INPUT_VCR_DVR: res = "vcr/dvr"; break;
-				case AV_INPUT_CBL_SAT: res = "cbl/sat"; break;
-				case AV_INPUT_GAME_TV: res = "game/tv"; break;
-				case AV_INPUT_AUX1: res = "aux1"; break;
-				case AV_INPUT_AUX2: res = "aux2"; break;
-				case AV_INPUT_TAPE: res = "tape"; break;
-				case AV_INPUT_TUNER: res = "tuner"; break;
-				case AV_INPUT_TUNER_AM: res = "tuner(AM)"; break;
-				case AV_INPUT_CD: res = "cd"; break;
-				case AV_INPUT_PHONO: res = "phono"; break;
-			}
-			break;
-		case AV_CMD_DIMMER:
-			switch(v) {
-				case AV_DIMMER_BRIGHTEST: res = "brightest"; break;
-				case AV_DIMMER_BRIGHT: res = "bright"; break;
-				case AV_DIMMER_DIM: res = "dim"; break;
-				case AV_DIMMER_DARK: res = "dark"; break;
-			}
-			break;
-		case AV_CMD_MODE:
-			switch(v) {
-				case AV_MODE_STEREO: res = "stereo"; break;
-				case AV_MODE_DIRECT: res = "direct"; break;
-				case AV_MODE_SURROUND: res = "surround"; break;
-				case AV_MODE_ALL_CH_STEREO: res = "allchstereo"; break;
-				case AV_MODE_FILM: res = "film"; break;
-				case AV_MODE_THX: res = "thx"; break;
-				case AV_MODE_ACTION: res = "action"; break;
-				case AV_MODE_MUSICAL: res = "musical"; break;
-				case AV_MODE_MONO_MOVIE: res = "monomovie"; break;
-				case AV_MODE_ORCHESTRA: res = "orchestra"; break;
-				case AV_MODE_UNPLUGGED: res = "unplugged"; break;
-				case AV_MODE_STUDIO_MIX: res = "studiomix"; break;
-				case AV_MODE_TV_LOGIC: res = "tvlogic"; break;
-				case AV_MODE_THEATER: res = "theater"; break;
-				case AV_MODE_ENHANCED7: res = "enhanced7"; break;
-				case AV_MODE_MONO: res = "mono"; break;
-				case AV_MODE_FULL_MONO: res = "fullmono"; break;
-				case AV_MODE_PURE_AUDIO: res = "pureaudio"; break;
-				case AV_MODE_PL_MOVIE: res = "plmovie"; break;
-				case AV_MODE_PL_MUSIC: res = "plmusic"; break;
-				case AV_MODE_NEO_CINEMA: res = "neocinema"; break;
-				case AV_MODE_NEO_MUSIC: res = "neomusic"; break;
-				case AV_MODE_NEO_THX_CINEMA: res = "neothxcinema"; break;
-				case AV_MODE_PL_THX_CINEMA: res = "plthxcinema"; break;
-				case AV_MODE_PL_GAME: res = "plgame"; break;
-				case AV_MODE_NEURAL_THX: res = "neuralthx"; break;
-			}
-			break;
-	}
-	if(!res) {
-		sprintf(buffer,"%d",v);
-		res = buffer;
+	pthread_once(&av_codec_once,&av_codec_init);
+	
+	if(cmd >= 0 && cmd < AV_NUM_COMMANDS && v >= 0 && v < 256 && av_value_names[cmd][v]) {
+		return av_value_names[cmd][v];
 	}
-	return res;
+	
+	sprintf(buffer,"%d",v);
+	return buffer;
 }
 
 int av_str2v(int cmd,const char* v) {
+	const struct av_value *value;
 	char *endptr;
 	int iv;
 	
-	switch(cmd) {
-		case AV_CMD_INPUT:
-			if(!strcmp(v,"dvd")) {
-				return AV_INPUT_DVD;
-			} else if(!strcmp(v,"vcr/dvr") || !strcmp(v,"vcr") || !strcmp(v,"dvr")) {
-				return AV_INPUT_VCR_DVR;
-			} else if(!strcmp(v,"cbl/sat") || !strcmp(v,"cbl") || !strcmp(v,"sat")) {
-				return AV_INPUT_CBL_SAT;
-			} else if(!strcmp(v,"game/tv") || !strcmp(v,"game") || !strcmp(v,"tv") || !strcmp(v,"dock")) {
-				return AV_INPUT_GAME_TV;
-			} else if(!strcmp(v,"aux1")) {
-				return AV_INPUT_AUX1;
-			} else if(!strcmp(v,"aux2")) {
-				return AV_INPUT_AUX2;
-			} else if(!strcmp(v,"tape")) {
-				return AV_INPUT_TAPE;
-			} else if(!strcmp(v,"tuner")) {
-				return AV_INPUT_TUNER;
-			} else if(!strcmp(v,"tuner(AM)")) {
-				return AV_INPUT_TUNER_AM;
-			} else if(!strcmp(v,"cd")) {
-				return AV_INPUT_CD;
-			} else if(!strcmp(v,"phono")) {
-				return AV_INPUT_PHONO;
-			}
-			break;
-		case AV_CMD_DIMMER:
-			if(!strcmp(v,"brightest")) {
-				return AV_DIMMER_BRIGHTEST;
-			} else if(!strcmp(v,"bright")) {
-				return AV_DIMMER_BRIGHT;
-			} else if(!strcmp(v,"dim")) {
-				return AV_DIMMER_DIM;
-			} else if(!strcmp(v,"dark")) {
-				return AV_DIMMER_DARK;
+	if(cmd >= 0 && cmd < AV_NUM_COMMANDS) {
+		for(value=av_commands[cmd].values;value && value->name;value++) {
+			if(!strcmp(v,value->name)) {
+				return value->value;
 			}
-			break;
-		case AV_CMD_MODE:
-			if(!strcmp(v,"stereo")) {
-				return AV_MODE_STEREO;
-			} else if(!strcmp(v,"direct")) {
-				return AV_MODE_DIRECT;
-			} else if(!strcmp(v,"surround")) {
-				return AV_MODE_SURROUND;
-			} else if(!strcmp(v,"allchstereo")) {
-				return AV_MODE_ALL_CH_STEREO;
-			} else if(!strcmp(v,"film")) {
-				return AV_MODE_FILM;
-			} else if(!strcmp(v,"thx")) {
-				return AV_MODE_THX;
-			} else if(!strcmp(v,"action")) {
-				return AV_MODE_ACTION;
-			} else if(!strcmp(v,"musical")) {
-				return AV_MODE_MUSICAL;
-			} else if(!strcmp(v,"monomovie")) {
-				return AV_MODE_MONO_MOVIE;
-			} else if(!strcmp(v,"orchestra")) {
-				return AV_MODE_ORCHESTRA;
-			} else if(!strcmp(v,"unplugged")) {
-				return AV_MODE_UNPLUGGED;
-			} else if(!strcmp(v,"studiomix")) {
-				return AV_MODE_STUDIO_MIX;
-			} else if(!strcmp(v,"tvlogic")) {
-				return AV_MODE_TV_LOGIC;
-			} else if(!strcmp(v,"theater")) {
-				return AV_MODE_THEATER;
-			} else if(!strcmp(v,"enhanced7")) {
-				return AV_MODE_ENHANCED7;
-			} else if(!strcmp(v,"mono")) {
-				return AV_MODE_MONO;
-			} else if(!strcmp(v,"fullmono")) {
-				return AV_MODE_FULL_MONO;
-			} else if(!strcmp(v,"pureaudio")) {
-				return AV_MODE_PURE_AUDIO;
-			} else if(!strcmp(v,"plmovie")) {
-				return AV_MODE_PL_MOVIE;
-			} else if(!strcmp(v,"plmusic")) {
-				return AV_MODE_PL_MUSIC;
-			} else if(!strcmp(v,"neocinema")) {
-				return AV_MODE_NEO_CINEMA;
-			} else if(!strcmp(v,"neomusic")) {
-				return AV_MODE_NEO_MUSIC;
-			} else if(!strcmp(v,"neothxcinema")) {
-				return AV_MODE_NEO_THX_CINEMA;
-			} else if(!strcmp(v,"plthxcinema")) {
-				return AV_MODE_PL_THX_CINEMA;
-			} else if(!strcmp(v,"plgame")) {
-				return AV_MODE_PL_GAME;
-			} else if(!strcmp(v,"neuralthx")) {
-				return AV_MODE_NEURAL_THX;
-			}
-			
-			break;
+		}
 	}
 
 	iv = strtol(v,&endptr,10);
@@ -785,27 +1215,26 @@ int av_str2v(int cmd,const char* v) {
 }
 
 int av_validvi(int cmd,int i) {
-	switch(cmd) {
-		case AV_CMD_POWER:
-		case AV_CMD_MUTE:
-			return i==0||i==1;
-		case AV_CMD_VOLUME:
-			return i>=0 && i<=60; /* can go "up" to -20... but that would break the current implementation */
-		case AV_CMD_PRESET:
-			return i>=0 && i<=30;
-		case AV_CMD_DIMMER:
-			return (i==AV_DIMMER_BRIGHTEST)||(i==AV_DIMMER_BRIGHT)||(i==AV_DIMMER_DIM)||(i==AV_DIMMER_DARK);
-		case AV_CMD_LATENIGHT:
-			return i>=0 && i<=2;
-		case AV_CMD_INPUT:
-			return av_v2str(cmd,i)[0]>=97; /* quick and dirty.. avoids another switch/case */
-		case AV_CMD_MODE:
-			return av_v2str(cmd,i)[0]>=97;
-	}
-	return i>=0 && i<=99;
+	const struct av_value *value;
+	
+	if(cmd < 0 || cmd >= AV_NUM_COMMANDS) {
+		return i>=0 && i<=99;
+	}
+	
+	if(av_commands[cmd].values) {
+		for(value=av_commands[cmd].values;value->name;value++) {
+			if(value->value == i) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+	
+	return i>=av_commands[cmd].min && i<=av_commands[cmd].max;
 }
 
 int av_validvs(int cmd,const char* v) {
+	const char **r;
 	int iv;
 	
 	iv = av_str2v(cmd,v);
@@ -813,26 +1242,13 @@ int av_validvs(int cmd,const char* v) {
 		return av_validvi(cmd,iv);
 	}
 	
-	switch(cmd) {
-		case AV_CMD_VOLUME:
-		case AV_CMD_MODE:
-		case AV_CMD_INPUT:
-		case AV_CMD_PRESET:
-			if(!strcmp(v,"up")||!strcmp(v,"down")) {
-				return 1;
-			}
-			break;
-		case AV_CMD_LATENIGHT:
-			if(!strcmp(v,"up")) {
+	if(cmd >= 0 && cmd < AV_NUM_COMMANDS) {
+		for(r=av_commands[cmd].relative;r && *r;r++) {
+			if(!strcmp(v,*r)) {
 				return 1;
 			}
-			break;
-		case AV_CMD_DIMMER:
-			if(!strcmp(v,"dim")) {
-				return 1;
-			}
-			break;
+		}
 	}
 	
 	return 0;
-}
\ No newline at end of file
+}
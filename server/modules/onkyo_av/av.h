@@ -108,49 +108,81 @@ enum {
 	AV_DIMMER_DARK		= 0x2,
 };
 
+typedef struct av_context* AVCTX;
+
+/*
+ * opens and initializes the connection to a receiver, returns NULL on error.
+ * communication is handled by the tty reactor from then on.
+ * av_init_tty accepts any tty_init address
+ */
+AVCTX av_init_tty(const char *devicename,void (*cb)(AVCTX,int,int),void *userdata);
+AVCTX av_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(AVCTX,int,int),void *userdata);
+/* network receivers speaking eISCP, port <= 0 selects the default 60128 */
+AVCTX av_init_eiscp(const char *host,int port,void (*cb)(AVCTX,int,int),void *userdata);
+
 /*
- * opens and initializes the connection to the device
+ * returns the userdata passed on initialization
  */
-int av_init_tty(const char *devicename,void (*cb)(int,int));
-int av_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(int,int));
+void *av_userdata(AVCTX c);
 
 /*
  * requests specified value from device
  */
-void av_req(int cmd);
+void av_req(AVCTX c,int cmd);
 
 /*
  * sets the value of the specified command
  */
-int av_seti(int cmd, int v);
-int av_sets(int cmd, const char* v);
+int av_seti(AVCTX c,int cmd, int v);
+int av_sets(AVCTX c,int cmd, const char* v);
+
+/*
+ * like av_seti, token (non-zero) is passed to the completion callback
+ * once the receiver answered with the new value (AV_DONE_OK), with
+ * another value or not at all (AV_DONE_FAILED), or the set was replaced
+ * by a newer one before it was sent (AV_DONE_SUPERSEDED)
+ */
+enum {
+	AV_DONE_OK,
+	AV_DONE_FAILED,
+	AV_DONE_SUPERSEDED,
+};
+
+int av_seti_token(AVCTX c,int cmd,int v,unsigned int token);
+void av_set_complete(AVCTX c,void (*cb)(AVCTX c,unsigned int token,int result));
 
 /*
  * returns current value of specified command
  * if value is not available, returns -1
  */
-int av_state(int cmd);
+int av_state(AVCTX c,int cmd);
+
+/*
+ * sets how many commands may await their reply at once (1-8, default 3)
+ */
+int av_set_window(AVCTX c,int window);
 
 /*
- * checks actions are pending, e.g. call to av_main is required
+ * polls the state of all commands at adaptive intervals, using at
+ * most budget bytes/s of the link. 0 disables polling (default)
  */
-int av_busy();
+int av_set_polling(AVCTX c,int budget);
 
 /*
- * closes the connection
+ * checks whether actions are pending
  */
-int av_stop();
+int av_busy(AVCTX c);
 
 /*
- * main routine, handles communication with device
- * errors occuring in this function are critical
+ * closes the connection and frees the context, unconfirmed
+ * commands fail. c must not be used afterwards.
  */
-extern int (*av_main)();
+int av_stop(AVCTX c);
 
 /*
- * returns last error, or NULL
+ * returns last error, or NULL. c may be NULL after a failed av_init_*
  */
-const char* av_error();
+const char* av_error(AVCTX c);
 
 /*
  * validate a value for a specific command
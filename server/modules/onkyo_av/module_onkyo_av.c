@@ -14,7 +14,6 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
@@ -23,10 +22,46 @@
 #include "../../../sharcs.h"
 #include "av.h"
 
-int module_id, device_id;
-void (*sharcs_callback)(sharcs_id,void*);
-pthread_t thread_handle;
-int thread_stop;
+int module_id;
+void (*sharcs_callback)(const struct sharcs_value*,int);
+void (*sharcs_complete)(sharcs_token,int);
+
+/* upper bound for the receiver to accept commands after power on */
+#define AV_WARMUP 4000
+
+/* sets passed by the core per second and pending per receiver, below the queue of the driver */
+#define AV_RATE 20
+#define AV_INFLIGHT 8
+
+/*
+ * receivers driven by this module, attached either to a
+ * tty device or, if tty is NULL, via libftdi. tty takes any
+ * tty_init address, e.g. "tcp:ser2net-host:4001"
+ */
+struct receiver {
+	const char *name;
+	const char *tty;
+	/* eISCP over the network */
+	const char *host;
+	int vendor, product;
+	const char *serial;
+	unsigned int index;
+	/* bytes/s spent on state polling, 9600 baud carry ~960 */
+	int poll;
+	
+	int device_id;
+	AVCTX av;
+	int power, warmup;
+};
+
+static struct receiver receivers[] = {
+	{"TX-SR875", NULL, NULL, 0x0403, 0x6001, NULL, 0, 10},
+	/* {"TX-SR875", "/dev/tty.usbserial-FTFRUS14", NULL, 0, 0, NULL, 0, 10}, */
+	/* {"TX-SR875", "tcp:livingroom.local:4001", NULL, 0, 0, NULL, 0, 10}, */
+	/* {"TX-NR616", NULL, "192.168.1.20", 0, 0, NULL, 0, 10}, */
+};
+
+#define NUM_RECEIVERS (int)(sizeof(receivers)/sizeof(struct receiver))
 
 
 static int enum_input[] = {
@@ -136,9 +171,12 @@ static const char* enum_dimmer_names[] = {
 };
 
 
-void av_callback(int cmd, int v) {
-	int *e;
+void av_callback(AVCTX av, int cmd, int v) {
+	struct receiver *r;
+	struct sharcs_value values[2];
+	int *e,n;
 	
+	r = (struct receiver*)av_userdata(av);
 	e = NULL;
 	
 	if(cmd == AV_CMD_MODE) {
@@ -159,99 +197,146 @@ void av_callback(int cmd, int v) {
 		}
 	}
 	
-	sharcs_callback(SHARCS_ID_FEATURE_MAKE(module_id,device_id,cmd+1),&v);
-}
-
-void *module_thread(void *threadid) {
-	int ret;
+	values[0].id 	= SHARCS_ID_FEATURE_MAKE(module_id,r->device_id,cmd+1);
+	values[0].value = v;
+	n = 1;
 	
-	ret = 1;
-	
-	while(!thread_stop && (ret=av_main())) {
+	/* receiver ignores commands while booting, it is ready once it answers queries */
+	if(cmd == AV_CMD_POWER) {
+		if(v && r->power == 0) {
+			r->warmup = 1;
+			av_req(av,AV_CMD_VOLUME);
+		} else if(!v) {
+			r->warmup = 0;
+		}
+		r->power = v;
+	} else if(r->warmup) {
+		r->warmup = 0;
+		values[n].id 	= r->device_id;
+		values[n].value = 0;
+		n++;
 	}
 	
-	if(!ret) {
-		fprintf(stderr,"mod_onkyo_av: %s\n",av_error());
+	sharcs_callback(values,n);
+}
+
+/* the receiver answered a set, or gave up on it */
+void av_done(AVCTX av, unsigned int token, int result) {
+	if(result == AV_DONE_OK) {
+		sharcs_complete(token,SHARCS_COMPLETE_OK);
+	} else if(result == AV_DONE_SUPERSEDED) {
+		sharcs_complete(token,SHARCS_COMPLETE_SUPERSEDED);
+	} else {
+		sharcs_complete(token,SHARCS_COMPLETE_FAILED);
 	}
-	
-	pthread_exit(NULL);
 }
 
 int module_start() {
-	if(thread_handle) {
-		return 0;
-	}
-	
-	int ret = 0;
-	
-	/* tty mode
-	if((ret = av_init_tty("/dev/tty.usbserial-FTFRUS14",&av_callback)) != 1) {
-		fprintf(stderr,"mod_onkyo_av: %s\n",av_error());
-		return 0;
-	}
-	*/
+	struct receiver *r;
+	int i,started = 0;
 	
-	/* libftdi mode */
-	if((ret = av_init_libftdi(0x0403, 0x6001,NULL,NULL,0,&av_callback)) != 1) {
-		fprintf(stderr,"mod_onkyo_av: %s\n",av_error());
-		return 0;
+	for(i=0;i<NUM_RECEIVERS;i++) {
+		r = &receivers[i];
+		if(r->av) {
+			continue;
+		}
+		
+		r->power = -1;
+		r->warmup = 0;
+		
+		if(r->host) {
+			r->av = av_init_eiscp(r->host,0,&av_callback,r);
+		} else if(r->tty) {
+			r->av = av_init_tty(r->tty,&av_callback,r);
+		} else {
+			r->av = av_init_libftdi(r->vendor,r->product,NULL,r->serial,r->index,&av_callback,r);
+		}
+		
+		if(!r->av) {
+			fprintf(stderr,"mod_onkyo_av: %s: %s\n",r->name,av_error(NULL));
+			continue;
+		}
+		
+		av_set_complete(r->av,&av_done);
+		av_req(r->av,AV_CMD_ALL);
+		av_set_polling(r->av,r->poll);
+		started++;
 	}
 	
-	av_req(AV_CMD_ALL);
-	
-	thread_stop = 0;
-	pthread_create(&thread_handle, NULL, module_thread, (void *)0);
-	
-	return 1;
+	return started>0;
 }
 
 int module_stop() {
-	if(!thread_handle) {
-		return 0;
-	}
+	int i,stopped = 0;
 	
-	thread_stop = 1;
-	pthread_join(0,NULL);
-	
-	av_stop();
+	for(i=0;i<NUM_RECEIVERS;i++) {
+		if(receivers[i].av) {
+			av_stop(receivers[i].av);
+			receivers[i].av = NULL;
+			stopped++;
+		}
+	}
 	
-	return 1;
+	return stopped>0;
 }
 
-int module_set_i(sharcs_id feature, int value) {
-	int cmd = SHARCS_INDEX_FEATURE(feature)-1;
+int module_set_token(sharcs_id feature, int value, sharcs_token token) {
+	struct receiver *r;
+	int cmd,d;
+	
+	d = SHARCS_INDEX_DEVICE(feature);
+	if(d < 1 || d > NUM_RECEIVERS || !receivers[d-1].av) {
+		return 0;
+	}
+	r = &receivers[d-1];
+	
+	cmd = SHARCS_INDEX_FEATURE(feature)-1;
 	if(cmd == AV_CMD_MODE) {
-		return av_seti(cmd,enum_mode[value]);
+		value = enum_mode[value];
 	} else if(cmd == AV_CMD_INPUT) {
-		return av_seti(cmd,enum_input[value]);
+		value = enum_input[value];
 	} else if(cmd == AV_CMD_DIMMER) {
-		return av_seti(cmd,enum_dimmer[value]);
+		value = enum_dimmer[value];
 	}
-	return av_seti(cmd,value);
+	return av_seti_token(r->av,cmd,value,token);
+}
+
+int module_set_i(sharcs_id feature, int value) {
+	return module_set_token(feature,value,0);
+}
+
+/* ISCP has no compound messages, the commands are queued back to back */
+int module_set_batch(const sharcs_id *features, const int *values, const sharcs_token *tokens, int n) {
+	int i;
+	
+	for(i=0;i<n;i++) {
+		if(module_set_token(features[i],values[i],tokens[i]) != 1) {
+			break;
+		}
+	}
+	
+	return i;
 }
 
 int module_set_s(sharcs_id feature, const char *value) {
 	return 0;
 }
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-int sharcs_init(struct sharcs_module *mod, void (*cb)(sharcs_id,void *v)) {
+/*
+ * creates the device structure of a receiver
+ */
+struct sharcs_device *receiver_device(struct sharcs_module *mod, struct receiver *r) {
 	struct sharcs_device *device;
 	struct sharcs_feature *feature;
-	int i = 0;
-	
-	device_id = SHARCS_ID_DEVICE_MAKE(mod->module_id,1);
-	
-	thread_handle = 0;
+	int i = 0, device_id = r->device_id;
 	
 	/* create device structure */
 	device = (struct sharcs_device*)malloc(sizeof(struct sharcs_device));
 	device->device_id 				= device_id;
-	device->device_name 			= "TX-SR875";
+	device->device_name 			= r->name;
 	device->device_description 		= "AV-Receiver";
+	device->device_flags 			= 0;
+	device->device_warmup 			= AV_WARMUP;
 	device->device_features_size 	= AV_NUM_COMMANDS;
 	device->device_features 		= (struct sharcs_feature**)malloc(sizeof(struct sharcs_feature*)*AV_NUM_COMMANDS);
 	
@@ -329,22 +414,42 @@ int sharcs_init(struct sharcs_module *mod, void (*cb)(sharcs_id,void *v)) {
 		}
 	}
 	
+	return device;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int sharcs_init_v2(struct sharcs_module *mod, void (*cb)(const struct sharcs_value*,int), void (*complete)(sharcs_token,int)) {
+	int i;
+	
+	mod->module_devices_size 	= NUM_RECEIVERS;
+	mod->module_devices 		= (struct sharcs_device**)malloc(sizeof(struct sharcs_device*)*NUM_RECEIVERS);
+	
+	for(i=0;i<NUM_RECEIVERS;i++) {
+		receivers[i].device_id 	= SHARCS_ID_DEVICE_MAKE(mod->module_id,(i+1));
+		receivers[i].av 		= NULL;
+		mod->module_devices[i] 	= receiver_device(mod,&receivers[i]);
+	}
+	
 	/* fill module structure */
 	mod->module_name 			= "OnkyoAV";
 	mod->module_description 	= "control Onkyo AV-Receiver via RS232";
 	mod->module_version 		= AV_VERSION;
-	mod->module_devices_size 	= 1;
-	mod->module_devices 		= (struct sharcs_device**)malloc(sizeof(struct sharcs_device*)*1);
-	mod->module_devices[0]		= device;
 	mod->module_start 			= &module_start;
 	mod->module_stop 			= &module_stop;
 	mod->module_set_i			= &module_set_i;
 	mod->module_set_s 			= &module_set_s;
+	mod->module_set_batch		= &module_set_batch;
+	mod->module_rate 			= AV_RATE;
+	mod->module_inflight 		= AV_INFLIGHT;
 	
 	module_id = mod->module_id;
 	
-	/* store callback function */
+	/* store callback functions */
 	sharcs_callback = cb;
+	sharcs_complete = complete;
 	
 	return 1;
 }
@@ -65,6 +65,7 @@ int sharcs_init(struct sharcs_module *mod, void (*cb)(sharcs_id,void *v)) {
 	device->device_id 				= device_id;
 	device->device_name 			= strdup(buffer);
 	device->device_description 		= "Stub";
+	device->device_flags 			= 0;
 	device->device_features_size 	= 1;
 	device->device_features 		= (struct sharcs_feature**)malloc(sizeof(struct sharcs_feature*)*1);
 	
@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "sim.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+int sim_running = 1;
+
+long long sim_now() {
+	struct timeval tv;
+	
+	gettimeofday(&tv,NULL);
+	
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+int sim_random(struct sim *s,int n) {
+	return n>0 ? rand_r(&s->seed)%n : 0;
+}
+
+void sim_usage(struct sim *s) {
+	fprintf(stderr,"usage: %s [-l latency] [-b baud] [-d drop%%] [-e event interval] [-s seed] [-p link | -t port] [-v]\n",s->name);
+	fprintf(stderr,"  -l ms    delay before a reply is sent (default %d)\n",s->latency);
+	fprintf(stderr,"  -b baud  pace output to the line speed, 0 for unlimited (default %d)\n",s->baud);
+	fprintf(stderr,"  -d n     drop n%% of the replies (default %d)\n",s->drop);
+	fprintf(stderr,"  -e ms    send an unsolicited event every ms, 0 for none (default %d)\n",s->event);
+	fprintf(stderr,"  -s n     random seed, runs are reproducible for a given seed\n");
+	fprintf(stderr,"  -p path  create a symlink to the slave device\n");
+	fprintf(stderr,"  -t port  accept a tcp connection instead of a pty, no pacing by default\n");
+	fprintf(stderr,"  -v       log traffic\n");
+}
+
+int sim_args(struct sim *s,int argc,char **argv) {
+	int c,baud = 0;
+	
+	while((c = getopt(argc,argv,"l:b:d:e:s:p:t:vh")) != -1) {
+		switch(c) {
+			case 'l':
+				s->latency = atoi(optarg);
+				break;
+			case 'b':
+				s->baud = atoi(optarg);
+				baud = 1;
+				break;
+			case 'd':
+				s->drop = atoi(optarg);
+				break;
+			case 'e':
+				s->event = atoi(optarg);
+				break;
+			case 's':
+				s->seed = strtoul(optarg,NULL,10);
+				break;
+			case 'p':
+				s->link = optarg;
+				break;
+			case 't':
+				s->port = atoi(optarg);
+				break;
+			case 'v':
+				s->verbose = 1;
+				break;
+			default:
+				return 0;
+		}
+	}
+	
+	if(s->latency < 0 || s->baud < 0 || s->drop < 0 || s->drop > 100 || s->event < 0 || s->port < 0 || (s->port && s->link)) {
+		return 0;
+	}
+	
+	/* the network is not limited by a line rate */
+	if(s->port && !baud) {
+		s->baud = 0;
+	}
+	
+	return 1;
+}
+
+int sim_listen(struct sim *s) {
+	struct sockaddr_in addr;
+	int on = 1;
+	
+	if((s->listenFd = socket(AF_INET,SOCK_STREAM,0)) < 0) {
+		fprintf(stderr,"%s: unable to create socket: %s\n",s->name,strerror(errno));
+		return 0;
+	}
+	setsockopt(s->listenFd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+	
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(s->port);
+	
+	if(bind(s->listenFd,(struct sockaddr*)&addr,sizeof(addr)) < 0 || listen(s->listenFd,1) < 0) {
+		fprintf(stderr,"%s: unable to listen on port %d: %s\n",s->name,s->port,strerror(errno));
+		return 0;
+	}
+	
+	printf("%s: listening on port %d\n",s->name,s->port);
+	fflush(stdout);
+	
+	return 1;
+}
+
+/*
+ * a new client replaces the current one
+ */
+void sim_accept(struct sim *s) {
+	int fd,on = 1;
+	
+	if((fd = accept(s->listenFd,NULL,NULL)) < 0) {
+		return;
+	}
+	
+	if(s->fd >= 0) {
+		close(s->fd);
+	}
+	
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+	
+	s->fd = fd;
+	s->readCounter = 0;
+}
+
+int sim_open(struct sim *s) {
+	struct termios options;
+	const char *slave;
+	
+	s->fd = -1;
+	s->listenFd = -1;
+	
+	if(s->port) {
+		if(!sim_listen(s)) {
+			return 0;
+		}
+	} else if((s->fd = posix_openpt(O_RDWR|O_NOCTTY)) < 0 || grantpt(s->fd) < 0 || unlockpt(s->fd) < 0) {
+		fprintf(stderr,"%s: unable to open pty: %s\n",s->name,strerror(errno));
+		return 0;
+	} else {
+		/* no line discipline, bytes go through unchanged */
+		tcgetattr(s->fd,&options);
+		cfmakeraw(&options);
+		tcsetattr(s->fd,TCSANOW,&options);
+		
+		fcntl(s->fd,F_SETFL,fcntl(s->fd,F_GETFL)|O_NONBLOCK);
+		
+		slave = ptsname(s->fd);
+		if(s->link) {
+			unlink(s->link);
+			if(symlink(slave,s->link) < 0) {
+				fprintf(stderr,"%s: unable to link %s: %s\n",s->name,s->link,strerror(errno));
+				return 0;
+			}
+		}
+		
+		printf("%s: listening on %s\n",s->name,s->link?s->link:slave);
+		fflush(stdout);
+	}
+	
+	s->readCounter = 0;
+	s->queueCount = 0;
+	s->lineFree = 0;
+	s->nextEvent = s->event ? sim_now()+s->event : 0;
+	s->received = s->sent = s->dropped = 0;
+	
+	return 1;
+}
+
+void sim_send(struct sim *s,const char *buf,int len,int delay) {
+	struct sim_message *m;
+	long long due;
+	int i;
+	
+	if(s->queueCount >= SIM_QUEUE_SIZE || len > (int)sizeof(m->data)) {
+		fprintf(stderr,"%s: output queue full, message lost\n",s->name);
+		return;
+	}
+	
+	/* keep the queue ordered, equal due times stay in order */
+	due = sim_now()+delay;
+	for(i=s->queueCount;i>0 && s->queue[i-1].due > due;i--) {
+		s->queue[i] = s->queue[i-1];
+	}
+	
+	m = &s->queue[i];
+	m->due = due;
+	m->length = len;
+	memcpy(m->data,buf,len);
+	s->queueCount++;
+}
+
+void sim_reply(struct sim *s,const char *buf,int len) {
+	if(sim_random(s,100) < s->drop) {
+		s->dropped++;
+		if(s->verbose) {
+			printf("drop %.*s\n",len,buf);
+		}
+		return;
+	}
+	
+	sim_send(s,buf,len,s->latency);
+}
+
+/*
+ * writes due messages. with pacing, a message occupies the line
+ * for 10 bit times per byte before the next one may start.
+ */
+void sim_flush(struct sim *s) {
+	struct sim_message *m;
+	long long now = sim_now();
+	
+	while(s->queueCount>0 && s->queue[0].due <= now && s->lineFree <= now) {
+		m = &s->queue[0];
+		
+		/* no client connected, the message goes nowhere */
+		if(s->fd < 0) {
+			;
+		} else if((s->port ? send(s->fd,m->data,m->length,MSG_NOSIGNAL) : write(s->fd,m->data,m->length)) < 0) {
+			/* nobody attached to the slave side yet */
+			if(errno == EAGAIN || errno == EIO) {
+				return;
+			}
+			if(!s->port) {
+				fprintf(stderr,"%s: write() failed: %s\n",s->name,strerror(errno));
+				sim_running = 0;
+				return;
+			}
+			close(s->fd);
+			s->fd = -1;
+		}
+		
+		if(s->verbose) {
+			printf("%6lld > %.*s\n",now%1000000,m->length,m->data);
+		}
+		
+		if(s->baud) {
+			s->lineFree = now+(m->length*10000LL+s->baud-1)/s->baud;
+		}
+		s->sent++;
+		
+		memmove(s->queue,s->queue+1,sizeof(struct sim_message)*(s->queueCount-1));
+		s->queueCount--;
+	}
+}
+
+/*
+ * splits the read buffer with the framer of the protocol
+ */
+void sim_read_custom(struct sim *s) {
+	int n,p,start,length;
+	
+	for(p=0;p<s->readCounter && (n = s->framer(s,s->readBuffer+p,s->readCounter-p,&start,&length)) > 0;p+=n) {
+		if(length < 0) {
+			continue;
+		}
+		if(s->verbose) {
+			printf("%6lld < %.*s\n",sim_now()%1000000,length,s->readBuffer+p+start);
+		}
+		s->received++;
+		s->frame(s,s->readBuffer+p+start,length);
+	}
+	
+	if(p == 0 && s->readCounter == SIM_FRAME_MAX) {
+		fprintf(stderr,"%s: frame too long, discarded\n",s->name);
+		p = s->readCounter;
+	}
+	
+	memmove(s->readBuffer,s->readBuffer+p,s->readCounter-p);
+	s->readCounter -= p;
+}
+
+void sim_read(struct sim *s) {
+	char *e;
+	int ret,l;
+	
+	ret = read(s->fd,s->readBuffer+s->readCounter,SIM_FRAME_MAX-s->readCounter);
+	if(ret == 0 && s->port) {
+		close(s->fd);
+		s->fd = -1;
+		return;
+	}
+	if(ret <= 0) {
+		return;
+	}
+	s->readCounter += ret;
+	
+	if(s->framer) {
+		sim_read_custom(s);
+		return;
+	}
+	
+	while((e = memchr(s->readBuffer,s->delimiter,s->readCounter))) {
+		l = e-s->readBuffer;
+		
+		/* tolerate CR LF */
+		if(l>0 && s->readBuffer[l-1] == '\r') {
+			l--;
+		}
+		
+		if(s->verbose) {
+			printf("%6lld < %.*s\n",sim_now()%1000000,l,s->readBuffer);
+		}
+		s->received++;
+		s->frame(s,s->readBuffer,l);
+		
+		l = e-s->readBuffer+1;
+		memmove(s->readBuffer,s->readBuffer+l,s->readCounter-l);
+		s->readCounter -= l;
+	}
+	
+	if(s->readCounter == SIM_FRAME_MAX) {
+		fprintf(stderr,"%s: frame too long, discarded\n",s->name);
+		s->readCounter = 0;
+	}
+}
+
+void sim_stop(int sig) {
+	sim_running = 0;
+}
+
+int sim_run(struct sim *s) {
+	struct pollfd pfd[2];
+	long long now, next;
+	int n;
+	
+	signal(SIGINT,&sim_stop);
+	signal(SIGTERM,&sim_stop);
+	signal(SIGPIPE,SIG_IGN);
+	
+	while(sim_running) {
+		now = sim_now();
+		
+		/* sleep until the next message or event is due */
+		next = s->queueCount>0 ? (s->queue[0].due > s->lineFree ? s->queue[0].due : s->lineFree) : 0;
+		if(s->nextEvent && (!next || s->nextEvent < next)) {
+			next = s->nextEvent;
+		}
+		
+		n = 0;
+		if(s->fd >= 0) {
+			pfd[n].fd = s->fd;
+			pfd[n].events = POLLIN;
+			pfd[n++].revents = 0;
+		}
+		if(s->listenFd >= 0) {
+			pfd[n].fd = s->listenFd;
+			pfd[n].events = POLLIN;
+			pfd[n++].revents = 0;
+		}
+		
+		if(poll(pfd,n,next ? (next>now ? (int)(next-now) : 0) : -1) < 0 && errno != EINTR) {
+			fprintf(stderr,"%s: poll() failed: %s\n",s->name,strerror(errno));
+			break;
+		}
+		
+		if(s->fd >= 0 && pfd[0].revents & POLLIN) {
+			sim_read(s);
+		/* slave side closed, wait for the driver to reopen it */
+		} else if(s->fd >= 0 && !s->port && pfd[0].revents & POLLHUP) {
+			usleep(100000);
+		}
+		
+		if(s->listenFd >= 0 && pfd[n-1].revents & POLLIN) {
+			sim_accept(s);
+		}
+		
+		if(s->nextEvent && sim_now() >= s->nextEvent) {
+			s->nextEvent += s->event;
+			if(s->tick) {
+				s->tick(s);
+			}
+		}
+		
+		sim_flush(s);
+	}
+	
+	printf("%s: received %d, sent %d, dropped %d\n",s->name,s->received,s->sent,s->dropped);
+	
+	if(s->link) {
+		unlink(s->link);
+	}
+	if(s->fd >= 0) {
+		close(s->fd);
+	}
+	if(s->listenFd >= 0) {
+		close(s->listenFd);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+/*
+ * device simulators, a pty pair stands in for the serial device.
+ * drivers in tty mode are pointed at the slave side (or the link).
+ */
+
+#define SIM_QUEUE_SIZE 256
+#define SIM_FRAME_MAX 256
+
+struct sim_message {
+	long long due;
+	int length;
+	char data[64];
+};
+
+struct sim {
+	const char *name, *link;
+	int fd;
+	
+	// tcp mode, one client at a time
+	int port, listenFd;
+	
+	// options
+	int latency, baud, drop, event;
+	unsigned int seed;
+	int verbose;
+	
+	// framing
+	char delimiter;
+	char readBuffer[SIM_FRAME_MAX];
+	int readCounter;
+	
+	// output, ordered by due time
+	struct sim_message queue[SIM_QUEUE_SIZE];
+	int queueCount;
+	long long lineFree, nextEvent;
+	
+	// counters
+	int received, sent, dropped;
+	
+	void (*frame)(struct sim *s,const char *buf,int len);
+	/* optional, replaces delimiter framing (see tty_set_framer) */
+	int (*framer)(struct sim *s,const char *buf,int len,int *start,int *length);
+	void (*tick)(struct sim *s);
+};
+
+/*
+ * parses the common options, returns 0 on error
+ */
+int sim_args(struct sim *s,int argc,char **argv);
+void sim_usage(struct sim *s);
+
+/*
+ * opens the pty pair and prints the slave name, or
+ * listens on the tcp port if one was given
+ */
+int sim_open(struct sim *s);
+
+/*
+ * answer to a received frame, delayed by the configured latency
+ * and dropped with the configured probability
+ */
+void sim_reply(struct sim *s,const char *buf,int len);
+
+/*
+ * sends buf after delay ms, never dropped
+ */
+void sim_send(struct sim *s,const char *buf,int len,int delay);
+
+/*
+ * random number in [0,n)
+ */
+int sim_random(struct sim *s,int n);
+
+long long sim_now();
+
+/*
+ * serves the device until interrupted
+ */
+int sim_run(struct sim *s);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * emulates a CUL stick running culfw. FS20 frames sent by the host
+ * spend duty cycle credit (LOVF when exhausted), received frames are
+ * reported in X01 mode and repeated like real senders do. events are
+ * remote presses on the actors below, drops are lost RF repeats.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+/* credit in 10ms units, 1% of an hour */
+#define CREDIT_MAX 3600
+#define CREDIT_FRAME 25
+#define REPEATS 3
+#define REPEAT_DELAY 120
+
+struct actor {
+	unsigned int housecode;
+	unsigned char address;
+};
+
+static struct actor actors[] = {
+	{0x758F, 0x01},
+	{0x758F, 0x00},
+};
+
+#define NUM_ACTORS (int)(sizeof(actors)/sizeof(struct actor))
+
+static const unsigned char events[] = {0x00, 0x11, 0x12, 0x08, 0x10};
+
+#define NUM_EVENTS (int)(sizeof(events)/sizeof(unsigned char))
+
+int mode = 0, credit = CREDIT_MAX;
+long long creditTime = 0;
+
+void cul_refill() {
+	long long now = sim_now();
+	
+	if(!creditTime) {
+		creditTime = now;
+	}
+	
+	/* 10ms of airtime per second */
+	credit += (now-creditTime)/1000;
+	creditTime += (now-creditTime)/1000*1000;
+	if(credit > CREDIT_MAX) {
+		credit = CREDIT_MAX;
+	}
+}
+
+void cul_frame(struct sim *s,const char *buf,int len) {
+	char out[32];
+	
+	if(len < 1) {
+		return;
+	}
+	
+	switch(buf[0]) {
+		case 'V':
+			sim_reply(s,out,sprintf(out,"V 1.44 CUL868\r\n"));
+			break;
+		case 'X':
+			if(len >= 3) {
+				sscanf(buf+1,"%2x",(unsigned int*)&mode);
+			} else {
+				cul_refill();
+				sim_reply(s,out,sprintf(out,"%02X %4d\r\n",mode,credit));
+			}
+			break;
+		case 'F':
+			if(len != 9 && len != 11) {
+				break;
+			}
+			cul_refill();
+			if(credit < CREDIT_FRAME) {
+				sim_reply(s,out,sprintf(out,"LOVF\r\n"));
+			} else {
+				credit -= CREDIT_FRAME;
+			}
+			break;
+	}
+}
+
+/*
+ * a remote is pressed, the frame is received up to REPEATS times
+ */
+void cul_tick(struct sim *s) {
+	struct actor *a;
+	char out[32];
+	int i,len;
+	
+	if(!(mode & 0x01)) {
+		return;
+	}
+	
+	a = &actors[sim_random(s,NUM_ACTORS)];
+	len = sprintf(out,"F%04X%02X%02X\r\n",a->housecode,a->address,events[sim_random(s,NUM_EVENTS)]);
+	
+	for(i=0;i<REPEATS;i++) {
+		if(sim_random(s,100) < s->drop) {
+			s->dropped++;
+			continue;
+		}
+		sim_send(s,out,len,s->latency+i*REPEAT_DELAY);
+	}
+}
+
+int main(int argc,char **argv) {
+	struct sim s;
+	
+	memset(&s,0,sizeof(s));
+	s.name = "sim_cul";
+	s.latency = 5;
+	s.baud = 38400;
+	s.delimiter = '\n';
+	s.frame = &cul_frame;
+	s.tick = &cul_tick;
+	
+	if(!sim_args(&s,argc,argv)) {
+		sim_usage(&s);
+		return 1;
+	}
+	
+	if(!sim_open(&s)) {
+		return 1;
+	}
+	
+	return sim_run(&s);
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2012 Martin Kleinhans <mail@mkleinhans.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * emulates an Onkyo receiver speaking ISCP over RS-232 (TX-SR875).
+ * every executed command is answered with the new value, queries with
+ * the current one. in standby only power commands are answered.
+ * in tcp mode messages are wrapped in eISCP packets like network
+ * receivers do.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+struct command {
+	const char *code;
+	int min, max, value;
+	/* cycle of values for "DIM", NULL if not supported */
+	const int *cycle;
+};
+
+static const int dimmer_cycle[] = {0x00,0x01,0x02,0x08,-1};
+
+static struct command commands[] = {
+	{"PWR", 0x00, 0x01, 0x00},
+	{"AMT", 0x00, 0x01, 0x00},
+	{"SLI", 0x00, 0x26, 0x10},
+	{"LMD", 0x00, 0x88, 0x00},
+	{"MVL", 0x00, 0x64, 0x20},
+	{"LTN", 0x00, 0x02, 0x00},
+	{"DIM", 0x00, 0x08, 0x00, dimmer_cycle},
+	{"PRS", 0x01, 0x28, 0x01},
+};
+
+#define NUM_COMMANDS (int)(sizeof(commands)/sizeof(struct command))
+
+#define EISCP_HEADER 16
+
+unsigned int be32(const char *b) {
+	const unsigned char *u = (const unsigned char*)b;
+	return ((unsigned int)u[0]<<24)|(u[1]<<16)|(u[2]<<8)|u[3];
+}
+
+int eiscp_frame(struct sim *s,const char *buf,int len,int *start,int *length) {
+	const char *p;
+	unsigned int h,d;
+	
+	if(memcmp(buf,"ISCP",len<4?len:4)) {
+		p = (const char*)memchr(buf+1,'I',len-1);
+		*length = -1;
+		return p ? p-buf : len;
+	}
+	
+	if(len < EISCP_HEADER) {
+		return 0;
+	}
+	
+	h = be32(buf+4);
+	d = be32(buf+8);
+	if(h < EISCP_HEADER || h+d > SIM_FRAME_MAX) {
+		*length = -1;
+		return 4;
+	}
+	if((unsigned int)len < h+d) {
+		return 0;
+	}
+	
+	for(p=buf+h+d;p>buf+h && (p[-1] == 0x1A || p[-1] == '\r' || p[-1] == '\n');p--);
+	
+	*start = h;
+	*length = p-(buf+h);
+	
+	return h+d;
+}
+
+/*
+ * sends a message, as reply (delayed, may be dropped) or right away
+ */
+void output(struct sim *s,const char *buf,int len,int reply) {
+	char packet[64];
+	
+	if(s->port) {
+		memset(packet,0,EISCP_HEADER);
+		memcpy(packet,"ISCP",4);
+		packet[7] = EISCP_HEADER;
+		packet[11] = len+2;
+		packet[12] = 0x01;
+		memcpy(packet+EISCP_HEADER,buf,len);
+		memcpy(packet+EISCP_HEADER+len,"\r\n",2);
+		
+		buf = packet;
+		len += EISCP_HEADER+2;
+	}
+	
+	if(reply) {
+		sim_reply(s,buf,len);
+	} else {
+		sim_send(s,buf,len,0);
+	}
+}
+
+int hex(const char *s,int *v) {
+	unsigned int x;
+	char c;
+	
+	if(sscanf(s,"%2x%c",&x,&c) != 1) {
+		return 0;
+	}
+	*v = x;
+	
+	return 1;
+}
+
+void report(struct sim *s,struct command *c,int unsolicited) {
+	char buf[16];
+	int len;
+	
+	len = sprintf(buf,"!1%s%02X\x1a",c->code,c->value);
+	output(s,buf,len,!unsolicited);
+}
+
+void onkyo_frame(struct sim *s,const char *buf,int len) {
+	struct command *c;
+	char arg[16];
+	int i,v;
+	
+	if(len < 5 || len > 5+(int)sizeof(arg)-1 || buf[0] != '!' || buf[1] != '1') {
+		return;
+	}
+	
+	for(c=NULL,i=0;i<NUM_COMMANDS;i++) {
+		if(!strncmp(buf+2,commands[i].code,3)) {
+			c = &commands[i];
+			break;
+		}
+	}
+	
+	if(!c) {
+		char na[16];
+		output(s,na,sprintf(na,"!1%.3sN/A\x1a",buf+2),1);
+		return;
+	}
+	
+	/* standby, the receiver does not listen */
+	if(c != &commands[0] && commands[0].value == 0) {
+		return;
+	}
+	
+	memcpy(arg,buf+5,len-5);
+	arg[len-5] = 0x0;
+	
+	if(!strcmp(arg,"QSTN")) {
+		;
+	} else if(!strcmp(arg,"UP")) {
+		c->value = c->value < c->max ? c->value+1 : c->min;
+	} else if(!strcmp(arg,"DOWN")) {
+		c->value = c->value > c->min ? c->value-1 : c->max;
+	} else if(!strcmp(arg,"DIM") && c->cycle) {
+		for(i=0;c->cycle[i] >= 0 && c->cycle[i] != c->value;i++);
+		c->value = c->cycle[i] >= 0 && c->cycle[i+1] >= 0 ? c->cycle[i+1] : c->cycle[0];
+	} else if(hex(arg,&v) && v >= c->min && v <= c->max) {
+		c->value = v;
+	} else {
+		char na[16];
+		output(s,na,sprintf(na,"!1%sN/A\x1a",c->code),1);
+		return;
+	}
+	
+	report(s,c,0);
+}
+
+/*
+ * somebody uses the remote: volume most of the time, sometimes mute or input
+ */
+void onkyo_tick(struct sim *s) {
+	struct command *c;
+	int r;
+	
+	if(commands[0].value == 0) {
+		return;
+	}
+	
+	r = sim_random(s,100);
+	if(r < 70) {
+		c = &commands[4];
+		c->value += sim_random(s,2) ? 1 : -1;
+		if(c->value < c->min) {
+			c->value = c->min;
+		} else if(c->value > c->max) {
+			c->value = c->max;
+		}
+	} else if(r < 85) {
+		c = &commands[1];
+		c->value = !c->value;
+	} else {
+		c = &commands[2];
+		c->value = sim_random(s,5);
+	}
+	
+	report(s,c,1);
+}
+
+int main(int argc,char **argv) {
+	struct sim s;
+	
+	memset(&s,0,sizeof(s));
+	s.name = "sim_onkyo";
+	s.latency = 30;
+	s.baud = 9600;
+	s.delimiter = '\n';
+	s.frame = &onkyo_frame;
+	s.tick = &onkyo_tick;
+	
+	if(!sim_args(&s,argc,argv)) {
+		sim_usage(&s);
+		return 1;
+	}
+	
+	if(s.port) {
+		s.framer = &eiscp_frame;
+	}
+	
+	if(!sim_open(&s)) {
+		return 1;
+	}
+	
+	return sim_run(&s);
+}
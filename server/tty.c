@@ -26,363 +26,1524 @@
 #include <sys/time.h>
 #include <ctype.h>
 #include <pthread.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #include <ftdi.h>
+
+#include "tty.h"
  
-enum {
- 	AV_MODE_STOPPED,
- 	AV_MODE_TTY,
-	AV_MODE_LIBFTDI,
+/*
+ * a transport moves bytes between the device and the context buffers,
+ * buffering, framing and the write queue are shared by all of them.
+ * read gets the poll events of the last reactor round and returns the
+ * number of bytes read, write the number of bytes written (0 if the
+ * device would block), both -1 on errors. watch registers the
+ * descriptors with the reactor and is called again after writes.
+ */
+struct tty_transport {
+	const char *scheme;
+	int (*open)(struct tty_context *ctx,const char *address);
+	int (*watch)(struct tty_context *ctx);
+	int (*read)(struct tty_context *ctx,int events,char *buf,int len);
+	int (*write)(struct tty_context *ctx,const char *buf,int len);
+	int (*close)(struct tty_context *ctx);
+	
+	// optional
+	int (*timeout)(struct tty_context *ctx);
+	int (*set_event_char)(struct tty_context *ctx,char c);
+	
+	// links that may come back, reopened after errors
+	int reconnect;
+};
+
+/* writing to a closed connection must not raise SIGPIPE */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* default upper bound of a received frame, excluding the delimiter */
+#define TTY_FRAME_MAX 256
+#define TTY_DELIMITER_MAX 4
+
+/* upper bound of queued commands per context, guards against a stuck device */
+#define TTY_QUEUE_MAX 4096
+
+/* delay before reopening a broken link (ms), doubled after each failed attempt */
+#define TTY_RECONNECT_MIN 1000
+#define TTY_RECONNECT_MAX 60000
+
+/* connects are bounded, reconnects block the reactor thread meanwhile */
+#define TTY_CONNECT_TIMEOUT 3000
+
+struct tty_command {
+	char *data;
+	int length;
+};
+
+/*
+ * ring of commands, doubled in size when full
+ */
+struct tty_queue {
+	struct tty_command *commands;
+	int size, head, count;
+};
+
+struct tty_context {
+	const struct tty_transport *transport;
+	int fd,events,registered;
+	
+	// transport specific
+	struct termios options;
+	struct ftdi_context ftdic;
+	struct ftdi_transfer_control *readTransfer;
+	unsigned char readByte;
+	
+	void (*callback)(TTYCTX,const char*,int);
+	void (*stateCallback)(TTYCTX,int);
+	void *userdata;
+	
+	// reconnecting, the address is kept by transports that reconnect
+	char *address;
+	int connected, backoff;
+	long long reconnect;
+	
+	// timer, fired from the reactor thread, armed from any thread
+	long long timer;
+	void (*timerCallback)(TTYCTX);
+	pthread_mutex_t mutex_timer;
+	
+	// framing
+	char delimiter[TTY_DELIMITER_MAX];
+	int delimiterLength, maxFrame, discard;
+	int (*framer)(TTYCTX,const char*,int,int*,int*);
+	
+	// buffers
+	char *readBuffer,error[256];
+	int readSize, readCounter, readScanned;
+	
+	// commands waiting to be written, one queue per priority class. writes are refused while not connected
+	struct tty_queue queues[TTY_PRIO_NUM];
+	struct tty_command current;
+	int currentOffset, writeCounter;
+	pthread_mutex_t mutex_write;// = PTHREAD_MUTEX_INITIALIZER;
+};
+
+/*------------------------------------------------------
+ * reactor
+ *
+ * all started contexts are multiplexed by a single thread.
+ * on linux the file descriptors are watched through epoll,
+ * elsewhere the watch list is handed to poll().
+ *------------------------------------------------------*/
+
+struct tty_watch {
+	int fd,events;
+	struct tty_context *ctx;
 };
 
-#define BUFFER_SIZE 128
+pthread_t reactor_thread;
+pthread_mutex_t reactor_mutex;
+int reactor_initialized = 0, reactor_running = 0, reactor_pipe[2], reactor_fd = -1;
+volatile int reactor_signaled = 0;
+struct tty_context **reactor_contexts = NULL;
+int reactor_contexts_size = 0;
+struct tty_watch *reactor_watches = NULL;
+int reactor_watches_size = 0;
+
+/*------------------------------------------------------
+ * functions
+ *------------------------------------------------------*/
+	 
+int tty_process(struct tty_context *ctx);
+void tty_unregister(struct tty_context *ctx);
+int tty_flush(struct tty_context *ctx);
+int tty_queue_pop(struct tty_queue *q,struct tty_command *c);
+void tty_fail(struct tty_context *ctx);
+void tty_reconnect(struct tty_context *ctx);
+	
+const char* tty_error(struct tty_context *ctx) {
+	if(ctx->error[0]==0) {
+		return NULL;
+	}
+	return ctx->error;
+}
+
+long long tty_now() {
+	struct timeval tv;
+	
+	gettimeofday(&tv,NULL);
+	
+	return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
+/*
+ * wakes the reactor, only the first caller since the last round writes to the pipe
+ */
+void tty_wakeup() {
+	if(reactor_running && !__sync_lock_test_and_set(&reactor_signaled,1)) {
+		write(reactor_pipe[1], ".", 1);
+	}
+}
+
+void tty_wakeup_drain() {
+	char tmpBuffer[32];
+	
+	__sync_lock_release(&reactor_signaled);
+	read(reactor_pipe[0], tmpBuffer, 32);
+}
+
+/*
+ * converts between poll() and epoll event masks
+ */
+#ifdef __linux__
+int tty_epoll_events(int events) {
+	return ((events & POLLIN)?EPOLLIN:0)|((events & POLLOUT)?EPOLLOUT:0)|EPOLLERR|EPOLLHUP;
+}
+#endif
+
+/*
+ * adds, updates (events>=0) or removes (events<0) a watched file descriptor
+ */
+void tty_watch(struct tty_context *ctx,int fd,int events) {
+	int i;
+	
+	pthread_mutex_lock(&reactor_mutex);
+	
+	for(i=0;i<reactor_watches_size;i++) {
+		if(reactor_watches[i].fd == fd) {
+			break;
+		}
+	}
+	
+	if(i<reactor_watches_size && reactor_watches[i].events == events) {
+		pthread_mutex_unlock(&reactor_mutex);
+		return;
+	}
+	
+#ifdef __linux__
+	struct epoll_event ev;
+	
+	memset(&ev,0,sizeof(ev));
+	ev.events 	= tty_epoll_events(events);
+	ev.data.ptr = ctx;
+	
+	if(events < 0) {
+		epoll_ctl(reactor_fd,EPOLL_CTL_DEL,fd,&ev);
+	} else if(i<reactor_watches_size) {
+		epoll_ctl(reactor_fd,EPOLL_CTL_MOD,fd,&ev);
+	} else {
+		epoll_ctl(reactor_fd,EPOLL_CTL_ADD,fd,&ev);
+	}
+#endif
+	
+	if(events < 0) {
+		if(i<reactor_watches_size) {
+			reactor_watches[i] = reactor_watches[--reactor_watches_size];
+		}
+	} else if(i<reactor_watches_size) {
+		reactor_watches[i].events = events;
+	} else {
+		reactor_watches = (struct tty_watch*)realloc(reactor_watches,sizeof(struct tty_watch)*(reactor_watches_size+1));
+		reactor_watches[reactor_watches_size].fd 		= fd;
+		reactor_watches[reactor_watches_size].events 	= events;
+		reactor_watches[reactor_watches_size].ctx 		= ctx;
+		reactor_watches_size++;
+	}
+	
+	pthread_mutex_unlock(&reactor_mutex);
+	
+	/* poll() picks up the new list on the next round */
+#ifndef __linux__
+	tty_wakeup();
+#endif
+}
+
+/*
+ * libusb announces the file descriptors it wants watched
+ */
+void tty_usb_added(int fd,short events,void *userdata) {
+	tty_watch((struct tty_context*)userdata,fd,events);
+}
+
+void tty_usb_removed(int fd,void *userdata) {
+	tty_watch((struct tty_context*)userdata,fd,-1);
+}
+
+/*
+ * computes how long the reactor may sleep (ms), -1 if there is nothing to wait for
+ */
+int tty_reactor_timeout() {
+	long long now,t;
+	int i,timeout;
+	
+	now = tty_now();
+	timeout = -1;
+	
+	for(i=0;i<reactor_contexts_size;i++) {
+		struct tty_context *ctx = reactor_contexts[i];
+		
+		pthread_mutex_lock(&ctx->mutex_timer);
+		t = ctx->timer;
+		pthread_mutex_unlock(&ctx->mutex_timer);
+		
+		if(t > 0) {
+			t -= now;
+			if(t < 0) {
+				t = 0;
+			}
+			if(timeout < 0 || t < timeout) {
+				timeout = t;
+			}
+		}
+		if(!ctx->connected) {
+			t = ctx->reconnect-now;
+			if(t < 0) {
+				t = 0;
+			}
+			if(timeout < 0 || t < timeout) {
+				timeout = t;
+			}
+		} else if(ctx->transport->timeout && (t = ctx->transport->timeout(ctx)) >= 0) {
+			if(timeout < 0 || t < timeout) {
+				timeout = t;
+			}
+		}
+	}
+	
+	return timeout;
+}
+
+/*
+ * blocks until a watched descriptor becomes ready, marks the
+ * affected contexts and drains the wake-up pipe
+ */
+int tty_reactor_wait(int timeout) {
+	int i,n;
+	
+#ifdef __linux__
+	struct epoll_event events[32];
+	
+	n = epoll_wait(reactor_fd,events,32,timeout);
+	if(n < 0) {
+		return errno == EINTR;
+	}
+	
+	pthread_mutex_lock(&reactor_mutex);
+	for(i=0;i<n;i++) {
+		struct tty_context *ctx = (struct tty_context*)events[i].data.ptr;
+		
+		if(!ctx) {
+			tty_wakeup_drain();
+			continue;
+		}
+		ctx->events |= ((events[i].events & EPOLLIN)?POLLIN:0)|((events[i].events & EPOLLOUT)?POLLOUT:0)|((events[i].events & (EPOLLERR|EPOLLHUP))?POLLERR:0);
+	}
+	pthread_mutex_unlock(&reactor_mutex);
+#else
+	struct pollfd *fds;
+	int size;
+	
+	pthread_mutex_lock(&reactor_mutex);
+	size = reactor_watches_size+1;
+	fds = (struct pollfd*)malloc(sizeof(struct pollfd)*size);
+	fds[0].fd 		= reactor_pipe[0];
+	fds[0].events 	= POLLIN;
+	for(i=1;i<size;i++) {
+		fds[i].fd 		= reactor_watches[i-1].fd;
+		fds[i].events 	= reactor_watches[i-1].events;
+	}
+	pthread_mutex_unlock(&reactor_mutex);
+	
+	n = poll(fds,size,timeout);
+	if(n < 0) {
+		free(fds);
+		return errno == EINTR;
+	}
+	
+	if(fds[0].revents & POLLIN) {
+		tty_wakeup_drain();
+	}
+	
+	pthread_mutex_lock(&reactor_mutex);
+	for(i=1;i<size && i<=reactor_watches_size;i++) {
+		if(fds[i].revents && reactor_watches[i-1].fd == fds[i].fd) {
+			reactor_watches[i-1].ctx->events |= fds[i].revents;
+		}
+	}
+	pthread_mutex_unlock(&reactor_mutex);
+	
+	free(fds);
+#endif
+	
+	return 1;
+}
+
+void *tty_reactor(void *arg) {
+	int i;
+	
+	int timeout;
+	
+	while(reactor_running) {
+		pthread_mutex_lock(&reactor_mutex);
+		timeout = tty_reactor_timeout();
+		pthread_mutex_unlock(&reactor_mutex);
+		
+		if(!tty_reactor_wait(timeout)) {
+			fprintf(stderr,"tty: reactor failed: %s\n",strerror(errno));
+			break;
+		}
+		
+		pthread_mutex_lock(&reactor_mutex);
+		
+		/* walk backwards, failing contexts remove themselves */
+		for(i=reactor_contexts_size-1;i>=0;i--) {
+			struct tty_context *ctx;
+			void (*timerCallback)(TTYCTX);
+			int ret;
+			
+			if(i >= reactor_contexts_size) {
+				continue;
+			}
+			ctx = reactor_contexts[i];
+			
+			/* timers keep running while a broken link waits to be reopened */
+			if(ctx->connected) {
+				ret = tty_process(ctx);
+			} else {
+				tty_reconnect(ctx);
+				ret = 1;
+			}
+			
+			/* a timer armed meanwhile is kept, the callback may arm the next one */
+			timerCallback = NULL;
+			pthread_mutex_lock(&ctx->mutex_timer);
+			if(ret && ctx->timer > 0 && ctx->timer <= tty_now()) {
+				ctx->timer = 0;
+				timerCallback = ctx->timerCallback;
+			}
+			pthread_mutex_unlock(&ctx->mutex_timer);
+			
+			if(timerCallback) {
+				timerCallback(ctx);
+			}
+			
+			if(!ret) {
+				tty_fail(ctx);
+			}
+		}
+		
+		pthread_mutex_unlock(&reactor_mutex);
+	}
+	
+	pthread_exit(NULL);
+}
+
+int tty_reactor_start() {
+	pthread_mutexattr_t attr;
+	
+	if(reactor_running) {
+		return 1;
+	}
+	
+	if(!reactor_initialized) {
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&reactor_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		reactor_initialized = 1;
+	}
+	
+	if(pipe(reactor_pipe) < 0) {
+		return 0;
+	}
+	fcntl(reactor_pipe[0],F_SETFL,O_NONBLOCK);
+	
+#ifdef __linux__
+	struct epoll_event ev;
+	
+	if((reactor_fd = epoll_create(8)) < 0) {
+		close(reactor_pipe[0]);
+		close(reactor_pipe[1]);
+		return 0;
+	}
+	
+	memset(&ev,0,sizeof(ev));
+	ev.events 	= EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(reactor_fd,EPOLL_CTL_ADD,reactor_pipe[0],&ev);
+#endif
+	
+	reactor_running = 1;
+	pthread_create(&reactor_thread, NULL, tty_reactor, NULL);
+	
+	return 1;
+}
+
+/*
+ * stops the reactor once the last context is gone. a context failing
+ * inside the reactor leaves the (idle) thread running for later contexts.
+ */
+void tty_reactor_stop() {
+	if(!reactor_running || reactor_contexts_size > 0 || pthread_equal(pthread_self(),reactor_thread)) {
+		return;
+	}
+	
+	reactor_running = 0;
+	write(reactor_pipe[1], ".", 1);
+	pthread_join(reactor_thread,NULL);
+	
+#ifdef __linux__
+	close(reactor_fd);
+	reactor_fd = -1;
+#endif
+	close(reactor_pipe[0]);
+	close(reactor_pipe[1]);
+	
+	free(reactor_watches);
+	reactor_watches = NULL;
+	reactor_watches_size = 0;
+	free(reactor_contexts);
+	reactor_contexts = NULL;
+}
+
+/*------------------------------------------------------------*/
+
+struct tty_context *tty_init_internal(void (*cb)(TTYCTX,const char*,int),void *userdata) {
+	struct tty_context *ctx;
+	
+	ctx = (struct tty_context*)malloc(sizeof(struct tty_context));
+	
+	ctx->transport = NULL;
+	ctx->fd = -1;
+	ctx->callback = cb;
+	ctx->stateCallback = NULL;
+	ctx->userdata = userdata;
+	ctx->address = NULL;
+	ctx->connected = 0;
+	ctx->backoff = TTY_RECONNECT_MIN;
+	ctx->reconnect = 0;
+	ctx->delimiter[0] = 0x0A;
+	ctx->delimiterLength = 1;
+	ctx->maxFrame = TTY_FRAME_MAX;
+	ctx->discard = 0;
+	ctx->framer = NULL;
+	ctx->error[0] = 0;
+	
+	ctx->readSize = ctx->maxFrame+ctx->delimiterLength;
+	ctx->readBuffer = (char*)malloc(ctx->readSize+1);
+	ctx->readCounter = 0;
+	ctx->readScanned = 0;
+	ctx->writeCounter = 0;
+	ctx->current.data = NULL;
+	ctx->currentOffset = 0;
+	memset(ctx->queues,0,sizeof(ctx->queues));
+	ctx->readTransfer = NULL;
+	ctx->events = 0;
+	ctx->registered = 0;
+	ctx->timer = 0;
+	ctx->timerCallback = NULL;
+	
+	pthread_mutex_init(&ctx->mutex_write, NULL);
+	pthread_mutex_init(&ctx->mutex_timer, NULL);
+	
+	return ctx;
+}
+
+void *tty_userdata(struct tty_context *ctx) {
+	return ctx->userdata;
+}
+
+int tty_set_event_char(struct tty_context *ctx,char e) {
+	return tty_set_delimiter(ctx,&e,1);
+}
+
+int tty_set_delimiter(struct tty_context *ctx,const char *d,int length) {
+	if(length<1 || length>TTY_DELIMITER_MAX || ctx->registered) {
+		return 0;
+	}
+	
+	memcpy(ctx->delimiter,d,length);
+	ctx->delimiterLength = length;
+	ctx->readScanned = 0;
+	
+	/* e.g. let the chip flush its buffer as soon as a frame is complete */
+	if(ctx->transport && ctx->transport->set_event_char) {
+		ctx->transport->set_event_char(ctx,ctx->delimiter[length-1]);
+	}
+	
+	return tty_set_max_frame(ctx,ctx->maxFrame);
+}
+
+int tty_set_framer(struct tty_context *ctx,int (*framer)(TTYCTX,const char*,int,int*,int*)) {
+	if(ctx->registered) {
+		return 0;
+	}
+	
+	ctx->framer = framer;
+	ctx->readScanned = 0;
+	
+	return 1;
+}
+
+int tty_set_max_frame(struct tty_context *ctx,int size) {
+	char *buffer;
+	
+	if(size<1 || ctx->registered || size+ctx->delimiterLength < ctx->readCounter) {
+		return 0;
+	}
+	
+	if(!(buffer = (char*)realloc(ctx->readBuffer,size+ctx->delimiterLength+1))) {
+		return 0;
+	}
+	
+	ctx->readBuffer = buffer;
+	ctx->readSize = size+ctx->delimiterLength;
+	ctx->maxFrame = size;
+	
+	return 1;
+}
+
+int tty_set_state_callback(struct tty_context *ctx,void (*cb)(TTYCTX,int)) {
+	ctx->stateCallback = cb;
+	return 1;
+}
+
+/* mutex_timer nests in the locks callers hold, it must not be reactor_mutex */
+int tty_set_timer(struct tty_context *ctx,int msec,void (*cb)(TTYCTX)) {
+	pthread_mutex_lock(&ctx->mutex_timer);
+	ctx->timerCallback = cb;
+	ctx->timer = msec<0 ? 0 : tty_now()+msec;
+	pthread_mutex_unlock(&ctx->mutex_timer);
+	
+	/* let the reactor recompute its timeout */
+	tty_wakeup();
+	
+	return 1;
+}
+
+/*------------------------------------------------------------*/
+/* transports                                                 */
+/*------------------------------------------------------------*/
+
+/* serial devices, terminals and sockets are plain descriptors */
+int tty_fd_watch(struct tty_context *ctx) {
+	tty_watch(ctx,ctx->fd,ctx->writeCounter>0?(POLLIN|POLLOUT):POLLIN);
+	return 1;
+}
+
+int tty_fd_read(struct tty_context *ctx,int events,char *buf,int len) {
+	int res = 0;
+	
+	if(events & POLLIN) {
+		res = read(ctx->fd,buf,len);
+		if(res<0 && errno != EAGAIN && errno != EINTR) {
+			sprintf(ctx->error,"read() failed");
+			return -1;
+		} else if(res<0) {
+			res = 0;
+		}
+	}
+	
+	if(events & POLLERR) {
+		sprintf(ctx->error,"device error");
+		return -1;
+	}
+	
+	return res;
+}
+
+int tty_fd_write(struct tty_context *ctx,const char *buf,int len) {
+	int ret;
+	
+	if((ret = write(ctx->fd,buf,len)) < 0) {
+		if(errno == EAGAIN || errno == EINTR) {
+			return 0;
+		}
+		sprintf(ctx->error,"write() failed");
+	}
+	
+	return ret;
+}
+
+int tty_fd_close(struct tty_context *ctx) {
+	if(ctx->fd>=0) {
+		close(ctx->fd);
+		ctx->fd = -1;
+	}
+	
+	return 1;
+}
+
+int tty_pty_open(struct tty_context *ctx,const char *address) {
+	struct termios options;
+	
+	if((ctx->fd = open(address,O_RDWR | O_NOCTTY | O_NDELAY)) < 0) {
+		sprintf(ctx->error,"%s - %s",address,strerror(errno));
+		return 0;
+	}
+	
+	/* no line settings, just make sure nothing is translated */
+	tcgetattr(ctx->fd,&options);
+	cfmakeraw(&options);
+	tcsetattr(ctx->fd,TCSANOW,&options);
+	
+	return 1;
+}
+
+int tty_serial_open(struct tty_context *ctx,const char *address) {
+	ctx->fd = open(address,O_RDWR | O_NOCTTY | O_NDELAY);
+	if (ctx->fd < 0) {
+		sprintf(ctx->error,"%s - %s",address,strerror(errno));
+		return 0;
+	}
+	
+	tcgetattr(ctx->fd, &ctx->options);
+	cfsetispeed(&ctx->options, B9600);
+	
+	ctx->options.c_cflag |= (CLOCAL | CREAD);
+	ctx->options.c_cflag &= ~PARENB;
+	ctx->options.c_cflag &= ~CSTOPB;
+	ctx->options.c_cflag &= ~CSIZE;
+	ctx->options.c_cflag |= CS8;
+	
+	tcsetattr(ctx->fd, TCSANOW, &ctx->options);
+	tcflush(ctx->fd,TCIOFLUSH);
+	
+	return 1;
+}
+
+int tty_serial_close(struct tty_context *ctx) {
+	if(ctx->fd>=0) {
+		tcsetattr(ctx->fd,TCSANOW,&ctx->options);
+	}
+	
+	return tty_fd_close(ctx);
+}
+
+/*
+ * connects a socket, waiting at most TTY_CONNECT_TIMEOUT. the socket
+ * is left non-blocking.
+ */
+int tty_tcp_connect(int fd,const struct sockaddr *addr,socklen_t addrlen) {
+	struct pollfd p;
+	socklen_t len;
+	int err;
+	
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+	
+	if(connect(fd,addr,addrlen) == 0) {
+		return 1;
+	}
+	if(errno != EINPROGRESS) {
+		return 0;
+	}
+	
+	p.fd = fd;
+	p.events = POLLOUT;
+	if((err = poll(&p,1,TTY_CONNECT_TIMEOUT)) <= 0) {
+		if(err == 0) {
+			errno = ETIMEDOUT;
+		}
+		return 0;
+	}
+	
+	len = sizeof(err);
+	if(getsockopt(fd,SOL_SOCKET,SO_ERROR,&err,&len) < 0) {
+		return 0;
+	}
+	if(err != 0) {
+		errno = err;
+		return 0;
+	}
+	
+	return 1;
+}
+
+/*
+ * address is host:port, e.g. a receiver's network port or a serial
+ * port exported raw by a terminal server (ser2net)
+ */
+int tty_tcp_open(struct tty_context *ctx,const char *address) {
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int ret,on = 1;
+	
+	if(!(port = strrchr(address,':')) || port == address || port-address >= (int)sizeof(host)) {
+		sprintf(ctx->error,"%.200s - expected host:port",address);
+		return 0;
+	}
+	memcpy(host,address,port-address);
+	host[port-address] = 0x0;
+	port++;
+	
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	if((ret = getaddrinfo(host,port,&hints,&res)) != 0) {
+		sprintf(ctx->error,"%s - %s",host,gai_strerror(ret));
+		return 0;
+	}
+	
+	/* connect synchronously, like opening a device */
+	for(ctx->fd=-1,ai=res;ai;ai=ai->ai_next) {
+		if((ctx->fd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol)) < 0) {
+			continue;
+		}
+		if(tty_tcp_connect(ctx->fd,ai->ai_addr,ai->ai_addrlen)) {
+			break;
+		}
+		close(ctx->fd);
+		ctx->fd = -1;
+	}
+	freeaddrinfo(res);
+	
+	if(ctx->fd < 0) {
+		sprintf(ctx->error,"%s:%s - %s",host,port,strerror(errno));
+		return 0;
+	}
+	
+	/* commands are small and latency matters more than throughput */
+	setsockopt(ctx->fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+#ifdef SO_NOSIGPIPE
+	setsockopt(ctx->fd,SOL_SOCKET,SO_NOSIGPIPE,&on,sizeof(on));
+#endif
+	
+	return 1;
+}
+
+int tty_tcp_read(struct tty_context *ctx,int events,char *buf,int len) {
+	int res;
+	
+	if(events & POLLIN) {
+		res = recv(ctx->fd,buf,len,0);
+		if(res==0) {
+			sprintf(ctx->error,"connection closed");
+			return -1;
+		} else if(res<0 && errno != EAGAIN && errno != EINTR) {
+			sprintf(ctx->error,"read() failed");
+			return -1;
+		} else if(res>0) {
+			return res;
+		}
+	}
+	
+	if(events & POLLERR) {
+		sprintf(ctx->error,"device error");
+		return -1;
+	}
+	
+	return 0;
+}
+
+int tty_tcp_write(struct tty_context *ctx,const char *buf,int len) {
+	int ret;
+	
+	if((ret = send(ctx->fd,buf,len,MSG_NOSIGNAL)) < 0) {
+		if(errno == EAGAIN || errno == EINTR) {
+			return 0;
+		}
+		sprintf(ctx->error,"write() failed");
+	}
+	
+	return ret;
+}
+
+int tty_libftdi_open_desc(struct tty_context *ctx,int vendor,int product,const char *description,const char *serial,unsigned int index) {
+	int ret;
+	
+	if (ftdi_init(&ctx->ftdic) < 0) {
+		sprintf(ctx->error, "ftdi_init failed");
+		return 0;
+	}
+	
+	if ((ret = ftdi_usb_open_desc_index(&ctx->ftdic, vendor,product,description,serial,index)) < 0) {
+		sprintf(ctx->error, "unable to open ftdi device: %d (%s)", ret, ftdi_get_error_string(&ctx->ftdic));
+		ftdi_deinit(&ctx->ftdic);
+		return 0;
+	}
+
+	ftdi_usb_purge_rx_buffer(&ctx->ftdic);
+	ftdi_set_latency_timer(&ctx->ftdic,40);
+	ftdi_set_event_char(&ctx->ftdic,ctx->delimiter[ctx->delimiterLength-1],1);
+	
+	return 1;
+}
+
+/*
+ * address is vendor:product[:serial[:index]], ids in hex
+ */
+int tty_libftdi_open(struct tty_context *ctx,const char *address) {
+	unsigned int vendor,product,index = 0;
+	char serial[64];
+	
+	serial[0] = 0x0;
+	if(sscanf(address,"%x:%x:%63[^:]:%u",&vendor,&product,serial,&index) < 2) {
+		sprintf(ctx->error,"%.200s - expected vendor:product[:serial[:index]]",address);
+		return 0;
+	}
+	
+	return tty_libftdi_open_desc(ctx,vendor,product,NULL,serial[0]?serial:NULL,index);
+}
+
+/*
+ * reads complete asynchronously into readByte, the rest of the usb
+ * packet stays buffered in libftdi until the next round
+ */
+int tty_libftdi_watch(struct tty_context *ctx) {
+	const struct libusb_pollfd **usbFDs;
+	int i;
+	
+	if(ctx->readTransfer) {
+		return 1;
+	}
+	
+	if(!(ctx->readTransfer = ftdi_read_data_submit(&ctx->ftdic,&ctx->readByte,1))) {
+		sprintf(ctx->error, "unable to submit read: %s", ftdi_get_error_string(&ctx->ftdic));
+		return 0;
+	}
+	
+	usbFDs = libusb_get_pollfds(ctx->ftdic.usb_ctx);
+	for(i=0;usbFDs && usbFDs[i];i++) {
+		tty_watch(ctx,usbFDs[i]->fd,usbFDs[i]->events);
+	}
+	libusb_free_pollfds(usbFDs);
+	
+	libusb_set_pollfd_notifiers(ctx->ftdic.usb_ctx,&tty_usb_added,&tty_usb_removed,ctx);
+	
+	return 1;
+}
+
+int tty_libftdi_read(struct tty_context *ctx,int events,char *buf,int len) {
+	struct timeval tv = {0,0};
+	int ret,n;
+	
+	/* let libusb complete transfers and handle its timeouts */
+	if(libusb_handle_events_timeout_completed(ctx->ftdic.usb_ctx,&tv,NULL) != 0) {
+		sprintf(ctx->error,"usb event handling failed");
+		return -1;
+	}
+	
+	if(!ctx->readTransfer->completed) {
+		return 0;
+	}
+	
+	ret = ftdi_transfer_data_done(ctx->readTransfer);
+	ctx->readTransfer = NULL;
+	
+	if(ret < 0) {
+		sprintf(ctx->error,"read() failed");
+		return -1;
+	}
+	
+	n = 0;
+	if(ret > 0) {
+		buf[n++] = ctx->readByte;
+	}
+	
+	/* fetch the rest of the usb packet buffered by libftdi */
+	ret = ctx->ftdic.readbuffer_remaining;
+	if(ret > len-n) {
+		ret = len-n;
+	}
+	if(ret > 0 && (ret = ftdi_read_data(&ctx->ftdic,(unsigned char*)buf+n,ret)) > 0) {
+		n += ret;
+	}
+	
+	/* submit next read */
+	if(!(ctx->readTransfer = ftdi_read_data_submit(&ctx->ftdic,&ctx->readByte,1))) {
+		sprintf(ctx->error,"read() failed");
+		return -1;
+	}
+	
+	return n;
+}
+
+int tty_libftdi_write(struct tty_context *ctx,const char *buf,int len) {
+	int ret;
+	
+	if((ret = ftdi_write_data(&ctx->ftdic,(unsigned char*)buf,len)) < 0) {
+		sprintf(ctx->error,"write() failed");
+	}
+	
+	return ret;
+}
+
+int tty_libftdi_close(struct tty_context *ctx) {
+	int ret;
+	
+	libusb_set_pollfd_notifiers(ctx->ftdic.usb_ctx,NULL,NULL,NULL);
+	
+	if (ctx->readTransfer) {
+		struct timeval tv = {1,0};
+		ftdi_transfer_data_cancel(ctx->readTransfer,&tv);
+		ctx->readTransfer = NULL;
+	}
+	if ((ret = ftdi_usb_close(&ctx->ftdic)) < 0) {
+		sprintf(ctx->error, "unable to close ftdi device: %d (%s)", ret, ftdi_get_error_string(&ctx->ftdic));
+		return 0;
+	}
 
-struct tty_context {
-	int fd,pipeFD[2],mode,ctrlChar;
-	struct termios options;
-	struct ftdi_context ftdic;
-	void (*callback)(const char*,int );
+	ftdi_deinit(&ctx->ftdic);
 	
-	// buffers
-	char readBuffer[BUFFER_SIZE], writeBuffer[BUFFER_SIZE],error[256];
-	int readCounter, writeCounter;
-	pthread_mutex_t mutex_write;// = PTHREAD_MUTEX_INITIALIZER;
-};
+	return 1;
+}
 
-/*------------------------------------------------------
- * functions
- *------------------------------------------------------*/
-	 
-int tty_main_tty(struct tty_context *ctx);
-int tty_main_libftdi(struct tty_context *ctx);
+int tty_libftdi_timeout(struct tty_context *ctx) {
+	struct timeval tv;
 	
-const char* tty_error(struct tty_context *ctx) {
-	if(ctx->error[0]==0) {
-		return NULL;
+	if(libusb_get_next_timeout(ctx->ftdic.usb_ctx,&tv) != 1) {
+		return -1;
 	}
-	return ctx->error;
+	
+	return tv.tv_sec*1000+(tv.tv_usec+999)/1000;
+}
+
+int tty_libftdi_set_event_char(struct tty_context *ctx,char c) {
+	return ftdi_set_event_char(&ctx->ftdic,c,1) == 0;
 }
 
+static const struct tty_transport tty_transports[] = {
+	{"serial", &tty_serial_open, &tty_fd_watch, &tty_fd_read, &tty_fd_write, &tty_serial_close, NULL, NULL, 0},
+	{"pty", &tty_pty_open, &tty_fd_watch, &tty_fd_read, &tty_fd_write, &tty_fd_close, NULL, NULL, 0},
+	{"tcp", &tty_tcp_open, &tty_fd_watch, &tty_tcp_read, &tty_tcp_write, &tty_fd_close, NULL, NULL, 1},
+	{"ftdi", &tty_libftdi_open, &tty_libftdi_watch, &tty_libftdi_read, &tty_libftdi_write, &tty_libftdi_close, &tty_libftdi_timeout, &tty_libftdi_set_event_char, 0},
+};
+
+#define TTY_TRANSPORT_SERIAL (&tty_transports[0])
+#define TTY_TRANSPORT_TCP (&tty_transports[2])
+#define TTY_TRANSPORT_LIBFTDI (&tty_transports[3])
+#define TTY_NUM_TRANSPORTS (int)(sizeof(tty_transports)/sizeof(struct tty_transport))
+
+void tty_free(struct tty_context *ctx) {
+	pthread_mutex_destroy(&ctx->mutex_write);
+	pthread_mutex_destroy(&ctx->mutex_timer);
+	free(ctx->address);
+	free(ctx->readBuffer);
+	free(ctx);
+}
 
-struct tty_context *tty_init_internal(void (*cb)(const char*,int)) {
+struct tty_context *tty_init_transport(const struct tty_transport *transport,const char *address,void (*cb)(TTYCTX,const char*,int),void *userdata) {
 	struct tty_context *ctx;
+	ctx = tty_init_internal(cb,userdata);
 	
-	ctx = (struct tty_context*)malloc(sizeof(struct tty_context));
+	if(!transport->open(ctx,address)) {
+		fprintf(stderr,"tty: %s\n",ctx->error);
+		tty_free(ctx);
+		return 0;
+	}
 	
-	ctx->callback = cb;
-	ctx->ctrlChar = 0x0A;
+	ctx->transport = transport;
+	ctx->connected = 1;
+	if(transport->reconnect) {
+		ctx->address = strdup(address);
+	}
 	
-	pipe(ctx->pipeFD);
+	return ctx;
+}
+
+struct tty_context *tty_init(const char *address,void (*cb)(TTYCTX,const char*,int),void *userdata) {
+	const char *p;
+	int i;
 	
-	ctx->readCounter = 0;
-	ctx->writeCounter = 0;
+	/* scheme:address, anything else is a device path */
+	if((p = strchr(address,':'))) {
+		for(i=0;i<TTY_NUM_TRANSPORTS;i++) {
+			if(strlen(tty_transports[i].scheme) == (size_t)(p-address) && !strncmp(address,tty_transports[i].scheme,p-address)) {
+				return tty_init_transport(&tty_transports[i],p+1,cb,userdata);
+			}
+		}
+	}
 	
-	pthread_mutex_init(&ctx->mutex_write, NULL);
+	return tty_init_transport(TTY_TRANSPORT_SERIAL,address,cb,userdata);
+}
+
+struct tty_context *tty_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(TTYCTX,const char*,int),void *userdata) {
+	struct tty_context *ctx;
+	ctx = tty_init_internal(cb,userdata);
+	
+	if(!tty_libftdi_open_desc(ctx,vendor,product,description,serial,index)) {
+		fprintf(stderr,"tty: %s\n",ctx->error);
+		tty_free(ctx);
+		return 0;
+	}
+	
+	ctx->transport = TTY_TRANSPORT_LIBFTDI;
+	ctx->connected = 1;
 	
 	return ctx;
 }
 
-int tty_set_event_char(struct tty_context *ctx,char e) {
-	ctx->ctrlChar = e;
+struct tty_context *tty_init_tty(const char *devicename,void (*cb)(TTYCTX,const char*,int),void *userdata) {
+	return tty_init_transport(TTY_TRANSPORT_SERIAL,devicename,cb,userdata);
+}
+
+struct tty_context *tty_init_tcp(const char *host,int port,void (*cb)(TTYCTX,const char*,int),void *userdata) {
+	char address[300];
 	
-	if(ctx->mode == AV_MODE_LIBFTDI) {
-		ftdi_set_event_char(&ctx->ftdic,ctx->ctrlChar,1);
-	}
+	snprintf(address,sizeof(address),"%s:%d",host,port);
 	
-	return 1;
+	return tty_init_transport(TTY_TRANSPORT_TCP,address,cb,userdata);
 }
 
-struct tty_context *tty_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(const char*,int)) {
+int tty_start(struct tty_context *ctx) {
 	int ret;
 	
-	struct tty_context *ctx;
-	ctx = tty_init_internal(cb);
+	if(!ctx->transport || ctx->registered) {
+		return 0;
+	}
 	
-	if (ftdi_init(&ctx->ftdic) < 0) {
-    	sprintf(ctx->error, "ftdi_init failed\n");
-    	return 0;
- 	}
+	if(!tty_reactor_start()) {
+		sprintf(ctx->error,"unable to start reactor");
+		return 0;
+	}
 	
-	if ((ret = ftdi_usb_open_desc_index(&ctx->ftdic, vendor,product,description,serial,index)) < 0) {
-    	sprintf(ctx->error, "unable to open ftdi device: %d (%s)\n", ret, ftdi_get_error_string(&ctx->ftdic));
-    	return 0;
+	pthread_mutex_lock(&reactor_mutex);
+	
+	reactor_contexts = (struct tty_context**)realloc(reactor_contexts,sizeof(struct tty_context*)*(reactor_contexts_size+1));
+	reactor_contexts[reactor_contexts_size++] = ctx;
+	ctx->registered = 1;
+	
+	ret = ctx->transport->watch(ctx);
+	
+	pthread_mutex_unlock(&reactor_mutex);
+	
+	if(!ret) {
+		tty_unregister(ctx);
+		return 0;
 	}
+	
+	tty_wakeup();
+	
+	return 1;
+}
 
-	ftdi_usb_purge_rx_buffer(&ctx->ftdic);
-	ftdi_set_latency_timer(&ctx->ftdic,40);
-	ftdi_set_event_char(&ctx->ftdic,ctx->ctrlChar,1);
-
-	// set tty_main implementation
-	ctx->mode = AV_MODE_LIBFTDI;
+/*
+ * removes all descriptors of the context from the reactor
+ */
+void tty_unwatch(struct tty_context *ctx) {
+	int i;
 	
-	return ctx;
+	pthread_mutex_lock(&reactor_mutex);
+	for(i=reactor_watches_size-1;i>=0;i--) {
+		if(reactor_watches[i].ctx == ctx) {
+			tty_watch(ctx,reactor_watches[i].fd,-1);
+		}
+	}
+	pthread_mutex_unlock(&reactor_mutex);
 }
 
-struct tty_context *tty_init_tty(const char *devicename,void (*cb)(const char*,int)) {
-	struct tty_context *ctx;
-	ctx = tty_init_internal(cb);
+/*
+ * removes the context from the reactor, stopping the reactor with the last context
+ */
+void tty_unregister(struct tty_context *ctx) {
+	int i;
 	
-	ctx->fd = open(devicename,O_RDWR | O_NOCTTY | O_NDELAY);
-	if (ctx->fd < 0) {
-		sprintf(ctx->error,"%s - %s",devicename,strerror(errno));
-		fprintf(stderr,ctx->error);
-		return 0;
+	if(!ctx->registered) {
+		return;
 	}
 	
-	tcgetattr(ctx->fd, &ctx->options);
-	cfsetispeed(&ctx->options, B9600);
+	pthread_mutex_lock(&reactor_mutex);
 	
-	ctx->options.c_cflag |= (CLOCAL | CREAD);
-	ctx->options.c_cflag &= ~PARENB;
-	ctx->options.c_cflag &= ~CSTOPB;
-	ctx->options.c_cflag &= ~CSIZE;
-	ctx->options.c_cflag |= CS8;
+	tty_unwatch(ctx);
 	
-	tcsetattr(ctx->fd, TCSANOW, &ctx->options);
-	tcflush(ctx->fd,TCIOFLUSH);
+	for(i=0;i<reactor_contexts_size;i++) {
+		if(reactor_contexts[i] == ctx) {
+			reactor_contexts[i] = reactor_contexts[--reactor_contexts_size];
+			break;
+		}
+	}
+	ctx->registered = 0;
 	
-	// set tty_main implementation
-	ctx->mode = AV_MODE_TTY;
+	pthread_mutex_unlock(&reactor_mutex);
 	
-	return ctx;
+	tty_reactor_stop();
 }
 
 int tty_busy(struct tty_context *ctx) {
 	return ctx->writeCounter>0||ctx->readCounter>0;
 }
 
+/*
+ * drops unsent commands, further writes are refused until the
+ * context is connected again
+ */
+void tty_drop(struct tty_context *ctx) {
+	struct tty_command c;
+	int i;
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	ctx->connected = 0;
+	for(i=0;i<TTY_PRIO_NUM;i++) {
+		while(tty_queue_pop(&ctx->queues[i],&c)) {
+			free(c.data);
+		}
+		free(ctx->queues[i].commands);
+		ctx->queues[i].commands = NULL;
+		ctx->queues[i].size = 0;
+	}
+	free(ctx->current.data);
+	ctx->current.data = NULL;
+	ctx->writeCounter = 0;
+	pthread_mutex_unlock( &ctx->mutex_write );
+}
+
 int tty_stop(struct tty_context *ctx) {
-	if(ctx->mode == AV_MODE_STOPPED) {
+	if(!ctx->transport) {
 		return 0;
 	}
 	
-	if(ctx->mode == AV_MODE_TTY && ctx->fd>=0) {
-		tcsetattr(ctx->fd,TCSANOW,&ctx->options);
-		close(ctx->fd);
-		ctx->fd = -1;
-	} else if(ctx->mode == AV_MODE_LIBFTDI) {
-		int ret = 0;
-		if ((ret = ftdi_usb_close(&ctx->ftdic)) < 0) {
-			sprintf(ctx->error, "unable to close ftdi device: %d (%s)\n", ret, ftdi_get_error_string(&ctx->ftdic));
+	tty_unregister(ctx);
+	
+	if(!ctx->transport->close(ctx)) {
+		return 0;
+	}
+	
+	tty_drop(ctx);
+	
+	ctx->transport = NULL;
+	
+	return 1;
+}
+
+void tty_close(struct tty_context *ctx) {
+	if(!ctx) {
+		return;
+	}
+	
+	tty_stop(ctx);
+	tty_free(ctx);
+}
+
+void tty_state(struct tty_context *ctx,int state) {
+	if(ctx->stateCallback) {
+		ctx->stateCallback(ctx,state);
+	}
+}
+
+/*
+ * called from the reactor when a context hit a critical error. links
+ * that may come back stay registered and are reopened by tty_reconnect,
+ * the others are stopped for good.
+ */
+void tty_fail(struct tty_context *ctx) {
+	fprintf(stderr,"tty: %s\n",tty_error(ctx)?tty_error(ctx):"unknown error");
+	
+	if(!ctx->transport->reconnect) {
+		tty_stop(ctx);
+		tty_state(ctx,TTY_FAILED);
+		return;
+	}
+	
+	tty_unwatch(ctx);
+	ctx->transport->close(ctx);
+	tty_drop(ctx);
+	
+	/* a partial frame of the old connection is useless */
+	ctx->readCounter = 0;
+	ctx->readScanned = 0;
+	ctx->discard = 0;
+	
+	ctx->backoff = TTY_RECONNECT_MIN;
+	ctx->reconnect = tty_now()+ctx->backoff;
+	
+	tty_state(ctx,TTY_DISCONNECTED);
+}
+
+/*
+ * reopens a broken link once its delay is over, called from the reactor
+ */
+void tty_reconnect(struct tty_context *ctx) {
+	if(ctx->reconnect > tty_now()) {
+		return;
+	}
+	
+	if(!ctx->transport->open(ctx,ctx->address)) {
+		ctx->backoff = ctx->backoff*2 > TTY_RECONNECT_MAX ? TTY_RECONNECT_MAX : ctx->backoff*2;
+		ctx->reconnect = tty_now()+ctx->backoff;
+		fprintf(stderr,"tty: %s, retrying in %d s\n",ctx->error,ctx->backoff/1000);
+		return;
+	}
+	
+	pthread_mutex_lock( &ctx->mutex_write );
+	ctx->connected = 1;
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	ctx->events = 0;
+	ctx->error[0] = 0;
+	fprintf(stderr,"tty: %s reconnected\n",ctx->address);
+	
+	ctx->transport->watch(ctx);
+	tty_state(ctx,TTY_CONNECTED);
+}
+
+int tty_queue_push(struct tty_queue *q,struct tty_command *c) {
+	if(q->count == q->size) {
+		struct tty_command *commands;
+		int i,size;
+		
+		size = q->size ? q->size*2 : 16;
+		commands = (struct tty_command*)malloc(sizeof(struct tty_command)*size);
+		if(!commands) {
 			return 0;
 		}
-
-		ftdi_deinit(&ctx->ftdic);
+		
+		/* unwrap the ring into the new array */
+		for(i=0;i<q->count;i++) {
+			commands[i] = q->commands[(q->head+i)%q->size];
+		}
+		free(q->commands);
+		
+		q->commands = commands;
+		q->size = size;
+		q->head = 0;
 	}
 	
-	close(ctx->pipeFD[0]);
-	close(ctx->pipeFD[1]);
+	q->commands[(q->head+q->count)%q->size] = *c;
+	q->count++;
+	
+	return 1;
+}
+
+int tty_queue_pop(struct tty_queue *q,struct tty_command *c) {
+	if(q->count == 0) {
+		return 0;
+	}
 	
-	ctx->mode = AV_MODE_STOPPED;
+	*c = q->commands[q->head];
+	q->head = (q->head+1)%q->size;
+	q->count--;
 	
 	return 1;
 }
 
-int tty_send(struct tty_context *ctx,const char *buf) {
-	int n;
+/*
+ * queues a command, higher priority classes are written first
+ */
+int tty_write(struct tty_context *ctx,const char *buf,int length,int prio) {
+	struct tty_command c;
+	
+	if(prio < 0 || prio >= TTY_PRIO_NUM) {
+		prio = TTY_PRIO_NORMAL;
+	}
 	
-	n = strlen(buf);
+	c.length = length;
+	if(length <= 0 || !(c.data = (char*)malloc(c.length))) {
+		return 0;
+	}
+	memcpy(c.data,buf,c.length);
 	
 	pthread_mutex_lock( &ctx->mutex_write );
 	
-	if(ctx->writeCounter+n>BUFFER_SIZE) {
-		fprintf(stderr,"tty: write buffer full, command skipped!\n");
+	if(!ctx->connected) {
+		pthread_mutex_unlock( &ctx->mutex_write );
+		free(c.data);
+		return 0;
+	}
+	
+	if(ctx->writeCounter >= TTY_QUEUE_MAX || !tty_queue_push(&ctx->queues[prio],&c)) {
+		fprintf(stderr,"tty: command queue full, command skipped!\n");
 		pthread_mutex_unlock( &ctx->mutex_write );
+		free(c.data);
 		return 0;
 	}
-	memcpy(ctx->writeBuffer+ctx->writeCounter,buf,n);
-	ctx->writeCounter+=n;
+	ctx->writeCounter++;
 	
 	pthread_mutex_unlock( &ctx->mutex_write );
 	
-	write(ctx->pipeFD[1], ".", 1);
+	/* the reactor flushes the queue on its next round */
+	tty_wakeup();
 	
 	return 1;
 }
 
-int tty_recv(struct tty_context *ctx,const char *s) {
-	ctx->callback(s,strlen(s));
-	return 1;
+int tty_send_prio(struct tty_context *ctx,const char *buf,int prio) {
+	return tty_write(ctx,buf,strlen(buf),prio);
 }
 
-int tty_main(struct tty_context *ctx) {
-	if(ctx->mode == AV_MODE_LIBFTDI) {
-		return tty_main_libftdi(ctx);
-	} else {
-		return tty_main_tty(ctx);
-	}
+int tty_send(struct tty_context *ctx,const char *buf) {
+	return tty_send_prio(ctx,buf,TTY_PRIO_NORMAL);
 }
 
-int tty_main_libftdi(struct tty_context *ctx) {
-	int ret,i,s,c;
-	char buf[64];
+/*
+ * returns the offset of the next delimiter in buf, -1 if there is none.
+ * memchr finds candidates, the remaining delimiter bytes are compared.
+ */
+int tty_delimiter(struct tty_context *ctx,const char *buf,int len) {
+	const char *p,*end;
+	int n = ctx->delimiterLength;
 	
-	if(ctx->mode != AV_MODE_LIBFTDI) {
-		return 0;
+	end = buf+len;
+	for(p=buf;p+n<=end && (p = (const char*)memchr(p,ctx->delimiter[0],end-p-n+1));p++) {
+		if(n == 1 || memcmp(p+1,ctx->delimiter+1,n-1) == 0) {
+			return p-buf;
+		}
 	}
 	
-	/* read data */
-	ret = ftdi_read_data(&ctx->ftdic,(unsigned char*)(ctx->readBuffer+ctx->readCounter),BUFFER_SIZE-ctx->readCounter);
-	if(ret > 0) {
-		ctx->readCounter += ret;
+	return -1;
+}
 
-		/* check for complete messages */
-		for(s=0,i=0;i<ctx->readCounter;i++) {
-			if(ctx->readBuffer[i] == ctx->ctrlChar) {
-				memcpy(buf,ctx->readBuffer+s,i-s);
-				buf[i-s] = 0x0;
-				tty_recv(ctx,buf);
-				s = i+1;
-			}
-		}
-		
-		if(s>=ctx->readCounter) {
-			ctx->readCounter = 0;
-		} else if(s>0) {
-			memmove(ctx->readBuffer,ctx->readBuffer+s,ctx->readCounter-s);
-			ctx->readCounter-=s;
+/*
+ * splits the read buffer with the framer of the protocol. frames are
+ * terminated in place, the byte after the frame is restored afterwards.
+ */
+int tty_frame_custom(struct tty_context *ctx) {
+	int n,s,start,length;
+	char c;
+	
+	for(s=0;s<ctx->readCounter && (n = ctx->framer(ctx,ctx->readBuffer+s,ctx->readCounter-s,&start,&length)) > 0;s+=n) {
+		if(length < 0) {
+			continue;
 		}
-		return 1;
-	} else if(ret < 0) {
-		sprintf(ctx->error,"read() failed");
-		tty_stop(ctx);
 		
-		return 0;
+		c = ctx->readBuffer[s+start+length];
+		ctx->readBuffer[s+start+length] = 0x0;
+		ctx->callback(ctx,ctx->readBuffer+s+start,length);
+		ctx->readBuffer[s+start+length] = c;
 	}
 	
-	/* write data */
-	if(ctx->writeCounter>0) {
-		// find length of first command
-		for(c=0;c<ctx->writeCounter;c++) {
-			if(ctx->writeBuffer[c] == '\n') {
-				c++;
-				break;
-			}
-		}
-		
-		pthread_mutex_lock( &ctx->mutex_write );
-		
-		
-		ret = ftdi_write_data(&ctx->ftdic,(unsigned char*)ctx->writeBuffer,c);
-		if(ret<0) {
-			sprintf(ctx->error,"write() failed");
-			tty_stop(ctx);
-			return 0;
-		} else if(ret==ctx->writeCounter) {
-			ctx->writeCounter=0;
-		} else if(ret>0){
-			memmove(ctx->writeBuffer,ctx->writeBuffer+ret,ctx->writeCounter-ret);
-			ctx->writeCounter-=ret;
-		}
+	/* incomplete frame that will never fit */
+	if(s == 0 && ctx->readCounter == ctx->readSize) {
+		fprintf(stderr,"tty: frame exceeds %d bytes, dropped\n",ctx->maxFrame);
+		s = ctx->readCounter;
+	}
 	
-		pthread_mutex_unlock( &ctx->mutex_write );
-		return 1;
-	} 
+	if(s>0) {
+		memmove(ctx->readBuffer,ctx->readBuffer+s,ctx->readCounter-s);
+		ctx->readCounter -= s;
+	}
 	
 	return 1;
 }
 
-int tty_main_tty(struct tty_context *ctx) {
-	int res,i,s;
-	char buf[64];
-	struct timeval tv;
+/*
+ * splits the read buffer into frames terminated by the delimiter. frames
+ * are handed to the callback in place, the first delimiter byte is
+ * replaced by a terminating zero. frames longer than maxFrame are dropped.
+ */
+int tty_frame(struct tty_context *ctx) {
+	int i,s;
 	
-	fd_set readFDs, writeFDs, exceptFDs;
+	if(ctx->framer) {
+		return tty_frame_custom(ctx);
+	}
 	
-	if(ctx->mode != AV_MODE_TTY) {
-		return 0;
+	for(s=0;(i = tty_delimiter(ctx,ctx->readBuffer+ctx->readScanned,ctx->readCounter-ctx->readScanned)) >= 0;) {
+		i += ctx->readScanned;
+		
+		if(ctx->discard) {
+			ctx->discard = 0;
+		} else if(i-s > ctx->maxFrame) {
+			fprintf(stderr,"tty: frame exceeds %d bytes, dropped\n",ctx->maxFrame);
+		} else {
+			ctx->readBuffer[i] = 0x0;
+			ctx->callback(ctx,ctx->readBuffer+s,i-s);
+		}
+		
+		s = ctx->readScanned = i+ctx->delimiterLength;
 	}
 	
-	tv.tv_sec 	= 30;
-	tv.tv_usec 	= 0;
+	/* a partial delimiter may be left at the end */
+	ctx->readScanned = ctx->readCounter-(ctx->delimiterLength-1);
+	if(ctx->readScanned < s) {
+		ctx->readScanned = s;
+	}
 	
-	if(ctx->fd<=0) {
-		sprintf(ctx->error,"not connected");
-		return 0;
+	/* no room left for the delimiter, skip to the next one */
+	if(ctx->readScanned-s > ctx->maxFrame) {
+		if(!ctx->discard) {
+			fprintf(stderr,"tty: frame exceeds %d bytes, dropped\n",ctx->maxFrame);
+		}
+		ctx->discard = 1;
+		s = ctx->readScanned;
 	}
 	
-	FD_ZERO(&readFDs);
-	FD_ZERO(&writeFDs);
-	FD_ZERO(&exceptFDs);
-
-	if(ctx->writeCounter>0) {
-		FD_SET(ctx->fd, &writeFDs);
+	if(s>0) {
+		memmove(ctx->readBuffer,ctx->readBuffer+s,ctx->readCounter-s);
+		ctx->readCounter -= s;
+		ctx->readScanned -= s;
 	}
-	FD_SET(ctx->fd, &readFDs);
-	FD_SET(ctx->fd, &exceptFDs);
-	FD_SET(ctx->pipeFD[0],&readFDs);
 	
-	res = select((ctx->fd>ctx->pipeFD[0]?ctx->fd:ctx->pipeFD[0])+1, &readFDs, &writeFDs, &exceptFDs, &tv);
+	return 1;
+}
+
+/*
+ * writes queued commands, highest priority first, as long as the device
+ * accepts them. a partially written command is always completed first.
+ */
+int tty_flush(struct tty_context *ctx) {
+	int ret,n,p;
 	
-	if(FD_ISSET(ctx->pipeFD[0],&readFDs)) {
-		char tmpBuffer[32];
-		read(ctx->pipeFD[0], tmpBuffer, 32);
-	}
-		
-	/* socket ready to read */
-	if(FD_ISSET(ctx->fd,&readFDs)) {
-		res = read(ctx->fd,ctx->readBuffer+ctx->readCounter,BUFFER_SIZE-ctx->readCounter);
-		/* received some bytes */
-		if(res>0) {
-			ctx->readCounter += res;
-
-			/* check for complete messages */
-			for(s=0,i=0;i<ctx->readCounter;i++) {
-				if(ctx->readBuffer[i] == ctx->ctrlChar) {
-					memcpy(buf,ctx->readBuffer+s,i-s);
-					buf[i-s] = 0x0;
-					tty_recv(ctx,buf);
-					s = i+1;
+	pthread_mutex_lock( &ctx->mutex_write );
+	
+	while(ctx->writeCounter>0) {
+		if(!ctx->current.data) {
+			for(p=0;p<TTY_PRIO_NUM;p++) {
+				if(tty_queue_pop(&ctx->queues[p],&ctx->current)) {
+					break;
 				}
 			}
-			
-			if(s>=ctx->readCounter) {
-				ctx->readCounter = 0;
-			} else if(s>0) {
-				memmove(ctx->readBuffer,ctx->readBuffer+s,ctx->readCounter-s);
-				ctx->readCounter-=s;
-			}
-		/* error */
-		} else if(res<0) {
-			sprintf(ctx->error,"read() failed");
-			tty_stop(ctx);
-			return 0;
+			ctx->currentOffset = 0;
 		}
 		
-		if(ctx->readCounter == BUFFER_SIZE) {
-			sprintf(ctx->error,"read buffer overflow detected\n");
-			tty_stop(ctx);
+		n = ctx->current.length-ctx->currentOffset;
+		
+		if((ret = ctx->transport->write(ctx,ctx->current.data+ctx->currentOffset,n)) < 0) {
+			pthread_mutex_unlock( &ctx->mutex_write );
 			return 0;
 		}
+		
+		ctx->currentOffset += ret;
+		if(ctx->currentOffset == ctx->current.length) {
+			free(ctx->current.data);
+			ctx->current.data = NULL;
+			ctx->writeCounter--;
+		/* device is full, wait until it becomes writable again */
+		} else {
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock( &ctx->mutex_write );
+	
+	/* e.g. wait for the device to become writable again */
+	return ctx->transport->watch(ctx);
+}
+
+/*
+ * one reactor round of a context: reads what the transport has,
+ * frames it and writes pending commands
+ */
+int tty_process(struct tty_context *ctx) {
+	int ret,events;
+	
+	events = ctx->events;
+	ctx->events = 0;
+	
+	if((ret = ctx->transport->read(ctx,events,ctx->readBuffer+ctx->readCounter,ctx->readSize-ctx->readCounter)) < 0) {
+		return 0;
 	}
 	
-	/* socket ready to write */
-	if(FD_ISSET(ctx->fd,&writeFDs)) {
-		pthread_mutex_lock( &ctx->mutex_write );
+	if(ret > 0) {
+		ctx->readCounter += ret;
 		
-		res = write(ctx->fd,ctx->writeBuffer,ctx->writeCounter);
-		if(res<0) {
-			sprintf(ctx->error,"write() failed");
-			tty_stop(ctx);
+		if(!tty_frame(ctx)) {
 			return 0;
-		} else if(res==ctx->writeCounter) {
-			ctx->writeCounter=0;
-		} else if(res>0){
-			memmove(ctx->writeBuffer,ctx->writeBuffer+res,ctx->writeCounter-res);
-			ctx->writeCounter-=res;
 		}
-		
-		pthread_mutex_unlock( &ctx->mutex_write );
 	}
 	
-	/* socket error */
-	if(FD_ISSET(ctx->fd,&exceptFDs)) {
-		sprintf(ctx->error,"device error");
-		tty_stop(ctx);
-		return 0;
-	}		
-		
+	/* write pending data, either queued by tty_send or left over */
+	if(ctx->writeCounter>0) {
+		return tty_flush(ctx);
+	}
+	
 	return 1;
 }
-	 
\ No newline at end of file
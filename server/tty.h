@@ -18,15 +18,86 @@
 #define _TTY_H_
 
 typedef struct tty_context* TTYCTX;
-	 
+
+/*
+ * priority classes of queued commands
+ */
+enum {
+	TTY_PRIO_HIGH,
+	TTY_PRIO_NORMAL,
+	TTY_PRIO_LOW,
+	
+	TTY_PRIO_NUM
+};
+
+/*
+ * connection states passed to the state callback
+ */
+enum {
+	TTY_CONNECTED,
+	TTY_DISCONNECTED,
+	TTY_FAILED
+};
+
+/*
+ * contexts are driven by a shared reactor thread, callbacks
+ * (received messages, timers) are invoked from that thread
+ */
 const char* tty_error(TTYCTX c);
-TTYCTX tty_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(const char*,int));
-TTYCTX tty_init_tty(const char *devicename,void (*cb)(const char*,int));
-int tty_main(TTYCTX c);
+
+/*
+ * opens a device by address: "tcp:host:port" (network receivers,
+ * serial ports exported by ser2net), "pty:path", "ftdi:vid:pid[:serial]"
+ * or a serial device path ("serial:path" or just the path)
+ */
+TTYCTX tty_init(const char *address,void (*cb)(TTYCTX,const char*,int),void *userdata);
+TTYCTX tty_init_libftdi(int vendor,int product,const char *description,const char *serial,unsigned int index,void (*cb)(TTYCTX,const char*,int),void *userdata);
+TTYCTX tty_init_tty(const char *devicename,void (*cb)(TTYCTX,const char*,int),void *userdata);
+TTYCTX tty_init_tcp(const char *host,int port,void (*cb)(TTYCTX,const char*,int),void *userdata);
+void *tty_userdata(TTYCTX c);
+int tty_start(TTYCTX c);
 int tty_busy(TTYCTX c);
 int tty_stop(TTYCTX c);
+
+/*
+ * stops the context if it is still running and frees it. must not
+ * be called from the callbacks of the context.
+ */
+void tty_close(TTYCTX c);
 int tty_send(TTYCTX c,const char *s);
-int tty_main(TTYCTX c);
+int tty_send_prio(TTYCTX c,const char *s,int prio);
+int tty_write(TTYCTX c,const char *data,int length,int prio);
 int tty_set_event_char(TTYCTX c,char e);
 
+/*
+ * received data is split into frames at the delimiter (default "\n"),
+ * frames longer than the maximum size are dropped. frames are passed
+ * to the callback without copying and are only valid during the call.
+ * both can only be changed before tty_start.
+ */
+int tty_set_delimiter(TTYCTX c,const char *d,int length);
+int tty_set_max_frame(TTYCTX c,int size);
+
+/*
+ * replaces delimiter framing for protocols with length headers.
+ * the framer returns the number of bytes consumed, 0 if buf holds
+ * no complete frame yet, and stores the payload position in start
+ * and length (length<0 to skip the bytes without a frame).
+ */
+int tty_set_framer(TTYCTX c,int (*framer)(TTYCTX c,const char *buf,int len,int *start,int *length));
+
+/*
+ * reports connection changes from the reactor thread. tcp contexts
+ * are reopened with growing delays after TTY_DISCONNECTED and report
+ * TTY_CONNECTED once they are back, other transports are stopped for
+ * good (TTY_FAILED). writes are refused and unsent commands dropped
+ * while the link is down.
+ */
+int tty_set_state_callback(TTYCTX c,void (*cb)(TTYCTX c,int state));
+
+/*
+ * arms a one-shot timer, msec<0 disarms it
+ */
+int tty_set_timer(TTYCTX c,int msec,void (*cb)(TTYCTX));
+
 #endif
\ No newline at end of file
@@ -30,6 +30,9 @@ enum {
 /*
  * packets
  */
+#define SHARCS_MAX_PACKET 1024		/* maximum size of a single frame */
+#define SHARCS_MAX_MESSAGE 65536	/* maximum size of a message sent as M_C_CHUNK frames */
+
 enum {
 	M_S_DISCONNECT,
 	M_S_FEATURE_I,
@@ -43,6 +46,8 @@ enum {
 	M_S_PROFILE_SAVE,
 	M_S_PROFILE_DELETE,
 	M_S_PROFILES,
+	M_S_PROFILE_LIST,
+	M_S_FEATURE_DESIRED,
 };
 
 enum {
@@ -56,6 +61,10 @@ enum {
 	M_C_PROFILE_SAVE,
 	M_C_PROFILE_DELETE,
 	M_C_PROFILES,
+	M_C_PROFILE_LIST,
+	M_C_CHUNK,
+	M_C_PROFILE_CAPTURE,
+	M_C_FEATURE_OP,
 };
 
 /*
@@ -75,11 +84,20 @@ enum {
 	SHARCS_VALUE_ERROR		= 0x0EFFFFFF,
 };
 
+/* operations of M_C_FEATURE_OP, based on the desired value of the feature */
+enum {
+	SHARCS_OP_ADD,		/* range: adds the argument, clamped to start and end */
+	SHARCS_OP_NEXT,		/* enum: moves by argument (1 next, -1 previous), wrapping around */
+	SHARCS_OP_TOGGLE,	/* switch */
+	SHARCS_OP_CAS,		/* any: sets the argument if the value equals expected */
+};
+
 enum {
 	SHARCS_FLAG_SLIDER		= 1 << 0,
 	SHARCS_FLAG_INVERSE		= 1 << 1,
 	SHARCS_FLAG_POWER		= 1 << 2,
 	SHARCS_FLAG_STANDBY		= 1 << 2,
+	SHARCS_FLAG_WARMUP		= 1 << 3,
 };
 
 struct sharcs_feature_range {
@@ -132,11 +150,49 @@ struct sharcs_device {
 	
 	int device_features_size;
 	struct sharcs_feature **device_features;
+	
+	/* 
+	 * ABI v2, milliseconds the device needs after being powered on before it accepts
+	 * commands. modules may report readiness earlier by passing the device id and its
+	 * flags without SHARCS_FLAG_WARMUP to the callback. fields of later versions are
+	 * appended, modules of earlier versions allocate the struct without them.
+	 */
+	int device_warmup;
 };
 
 /*
  * modules
+ *
+ * a module exports either sharcs_init(mod,cb), cb receiving one
+ * untyped value per call, or sharcs_init_v2(mod,cb,complete), cb
+ * receiving batches of sharcs_value. sharcs_init_v2 is preferred if
+ * both exist.
+ */
+#define SHARCS_MODULE_ABI 2
+
+/* reported state, features carry their value, devices their flags */
+struct sharcs_value {
+	sharcs_id id;
+	int value;
+};
+
+/*
+ * every value passed to module_set_batch comes with a token. once the
+ * device confirmed (or, without acknowledgement, the command went out)
+ * the module passes the token and the result to complete, exactly once
+ * for every accepted value. sets that are not completed in time are
+ * resolved as SHARCS_COMPLETE_TIMEOUT by the core.
  */
+typedef unsigned int sharcs_token;
+
+enum {
+	SHARCS_COMPLETE_OK,
+	SHARCS_COMPLETE_FAILED,
+	SHARCS_COMPLETE_TIMEOUT,
+	/* replaced by a later set of the same feature before it was sent */
+	SHARCS_COMPLETE_SUPERSEDED,
+};
+
 struct sharcs_module {
 	sharcs_id module_id;
 	
@@ -151,6 +207,20 @@ struct sharcs_module {
 	int (*module_stop)();
 	int (*module_set_i)(sharcs_id feature_id, int value);
 	int (*module_set_s)(sharcs_id feature_id, const char *value);
+	
+	/* 
+	 * optional (ABI v2), sets n features at once. returns the number of values
+	 * accepted, values after the first rejected one are not applied. without it
+	 * a set completes when the module reports the feature.
+	 */
+	int (*module_set_batch)(const sharcs_id *feature_ids, const int *values, const sharcs_token *tokens, int n);
+	
+	/*
+	 * optional, limits applied by the core when passing sets: sets per second
+	 * for the whole module and sets pending per device. 0 means unlimited.
+	 */
+	int module_rate;
+	int module_inflight;
 };
 
 /**
@@ -162,6 +232,14 @@ enum {
 	SHARCS_PROFILE_LOADED,
 };
 
+/* flags for M_C_PROFILE_LIST */
+enum {
+	SHARCS_PROFILE_LIST_SUMMARY = 1 << 0,	/* only send ids and names */
+};
+
+/* most profiles sent in one M_S_PROFILE_LIST page, larger limits are clamped */
+#define SHARCS_PROFILE_LIST_PAGE 32
+
 struct sharcs_profile {
 	unsigned int profile_id;
 	